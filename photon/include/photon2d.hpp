@@ -5,8 +5,21 @@
 #include <glm/glm.hpp>
 #include <stb_truetype/stb_truetype.h>
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 typedef int8_t i8;
@@ -28,7 +41,45 @@ namespace photon {
 
 typedef void (*KeyCallback)(i32, i32);
 
+struct Image;
 struct SpriteBatch;
+struct Renderer2D;
+struct VirtualTexture;
+
+struct FrameArena : std::pmr::memory_resource {
+    static constexpr usize DEFAULT_CAPACITY = 1 << 20;
+
+    FrameArena(usize capacity = DEFAULT_CAPACITY, std::pmr::memory_resource *upstream = std::pmr::get_default_resource());
+    ~FrameArena();
+
+    FrameArena(const FrameArena &other) = delete;
+    FrameArena &operator=(const FrameArena &other) = delete;
+
+    // Frees everything allocated since the last reset. If the frame overflowed the buffer,
+    // the buffer grows to fit it so later frames do not touch the upstream resource.
+    void reset();
+
+    usize used() const;
+    usize capacity() const;
+
+private:
+    struct OverflowBlock {
+        OverflowBlock *next;
+        usize size;
+        usize alignment;
+    };
+
+    std::pmr::memory_resource *upstream;
+    u8 *buffer = nullptr;
+    usize bufferCapacity = 0;
+    usize offset = 0;
+    OverflowBlock *overflow = nullptr;
+    usize overflowBytes = 0;
+
+    void *do_allocate(usize bytes, usize alignment) override;
+    void do_deallocate(void *pointer, usize bytes, usize alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+};
 
 struct Camera {
     glm::mat4 view;
@@ -53,18 +104,60 @@ struct Window {
     bool isKeyDown(i32 key);
 };
 
+// Compilation is only submitted by the constructor. The status is checked on the first bind(), so
+// drivers with KHR_parallel_shader_compile keep compiling while the app loads other things.
 struct ShaderProgram {
-    u32 handle;
+    u32 handle = 0;
 
     ShaderProgram() = default;
     ShaderProgram(std::string vertexCode, std::string fragmentCode);
 
+    // True once the program is compiled and linked. Never blocks with KHR_parallel_shader_compile,
+    // without it this waits for the driver like bind() does.
+    bool isReady();
     void bind();
 
-    void setInt(std::string location, i32 value);
-    void setFloat(std::string location, f32 value);
-    void setVec2(std::string location, glm::vec2 value);
-    void setMat4(std::string location, glm::mat4 value);
+    void setInt(const char *location, i32 value);
+    void setFloat(const char *location, f32 value);
+    void setVec2(const char *location, glm::vec2 value);
+    void setVec4Array(const char *location, const glm::vec4 *values, u32 count);
+    void setMat4(const char *location, glm::mat4 value);
+
+    void setInt(const std::string &location, i32 value);
+    void setFloat(const std::string &location, f32 value);
+    void setVec2(const std::string &location, glm::vec2 value);
+    void setVec4Array(const std::string &location, const glm::vec4 *values, u32 count);
+    void setMat4(const std::string &location, glm::mat4 value);
+
+private:
+    // Non-zero until the compile and link status was checked
+    u32 vertexHandle = 0;
+    u32 fragmentHandle = 0;
+
+    void checkStatus();
+};
+
+struct ShaderVariant {
+    enum Feature : u32 {
+        UNTEXTURED = 1 << 0,
+        GRAYSCALE = 1 << 1,
+        ALPHA_TEST = 1 << 2,
+        PREMULTIPLIED = 1 << 3,
+        SDF = 1 << 4,
+        CLIP = 1 << 5,
+        VIRTUAL = 1 << 6,
+        TWEEN = 1 << 7
+    };
+
+    static constexpr u32 FEATURE_COUNT = 8;
+    static constexpr u32 COUNT = 1 << FEATURE_COUNT;
+
+    // Coverage-based features need a texture to sample from, virtual textures are always color
+    static constexpr bool isValid(u32 features) {
+        return features < COUNT
+            && !((features & UNTEXTURED) && (features & (GRAYSCALE | SDF | VIRTUAL)))
+            && !((features & VIRTUAL) && (features & (GRAYSCALE | SDF)));
+    }
 };
 
 struct Texture {
@@ -76,27 +169,216 @@ struct Texture {
 
     u32 handle;
     TextureType type;
+    bool opaque = false;
+
+    // Set on the page cache of a virtual texture; sprites using it sample through the indirection table
+    VirtualTexture *virtualTexture = nullptr;
 
     Texture() = default;
     Texture(u8 *data, u32 width, u32 height, TextureType type);
     Texture(std::string path, TextureType type);
+    Texture(const Image &image);
 
     void bind();
+    void destroy();
 
     static void activate(u8 index);
 };
 
+// Pixels decoded on the CPU. Besides everything stb_image reads, QOI files and the LZ4 container written
+// by photon2d-texconv are recognized by their magic bytes; both decode far faster than PNG.
+struct Image {
+    // "P2LZ", followed by width, height, channels, chunk size and chunk count as little-endian u32,
+    // the compressed size of every chunk and the chunks. Each chunk is an LZ4 block of raw pixels.
+    static constexpr u32 LZ4_MAGIC = 0x5a4c3250;
+    static constexpr u32 LZ4_CHUNK_SIZE = 1 << 22;
+
+    u8 *data = nullptr;
+    u32 width = 0;
+    u32 height = 0;
+    Texture::TextureType type = Texture::RGBA;
+    // Found while decoding, so creating the texture does not scan the pixels again
+    bool opaque = false;
+
+    Image() = default;
+    Image(const std::string &path, Texture::TextureType type);
+
+    // Leaves data null if the bytes cannot be decoded
+    static Image decode(const u8 *bytes, usize size, Texture::TextureType type);
+
+    // channels is 3 or 4 for QOI and 1, 3 or 4 for the LZ4 container
+    static std::vector<u8> encodeQoi(const u8 *pixels, u32 width, u32 height, u32 channels);
+    static std::vector<u8> encodeLz4(const u8 *pixels, u32 width, u32 height, u32 channels);
+
+    u32 channels() const;
+
+    void destroy();
+};
+
+struct RenderTarget {
+    enum Format {
+        RGBA8,
+        RGBA16F
+    };
+
+    u32 fbo = 0;
+    u32 depthStencil = 0;
+    Texture texture;
+    glm::uvec2 dimensions = glm::uvec2(0);
+    Format format = RGBA8;
+
+    RenderTarget() = default;
+    RenderTarget(u32 width, u32 height, Format format = RGBA8, bool withDepthStencil = true);
+
+    void bind();
+    void destroy();
+};
+
+struct RenderTargetPool {
+    RenderTarget *acquire(glm::uvec2 dimensions, RenderTarget::Format format);
+    void release(RenderTarget *target);
+
+    // Destroys targets that have not been acquired for more than maxIdleFrames calls
+    void collect(u32 maxIdleFrames);
+
+    void destroy();
+
+private:
+    struct Entry {
+        RenderTarget *target;
+        bool inUse;
+        u32 idleFrames;
+    };
+
+    std::vector<Entry> entries;
+};
+
+struct PostEffect {
+    enum Type {
+        COLOR_GRADING,
+        VIGNETTE,
+        BLOOM,
+        CUSTOM
+    };
+
+    Type type = CUSTOM;
+    bool enabled = true;
+
+    // COLOR_GRADING: exposure, contrast, saturation
+    // VIGNETTE: intensity, radius, softness
+    // BLOOM: threshold, intensity, spread
+    glm::vec4 params = glm::vec4(0.0f);
+
+    // GLSL statements for CUSTOM effects, with color, uv and params in scope
+    std::string code;
+
+    PostEffect() = default;
+    PostEffect(Type type, glm::vec4 params);
+
+    static PostEffect colorGrading(f32 exposure, f32 contrast, f32 saturation);
+    static PostEffect vignette(f32 intensity, f32 radius, f32 softness);
+    static PostEffect bloom(f32 threshold, f32 intensity, f32 spread);
+    static PostEffect custom(std::string code, glm::vec4 params = glm::vec4(0.0f));
+
+    // False when disabled or when the parameters make the effect a no-op
+    bool isActive() const;
+};
+
+// Animation of a sprite's position, scale and color evaluated by the vertex shader, see Renderer2D::startTween
+struct Tween {
+    enum Easing : u32 {
+        LINEAR,
+        EASE_IN,
+        EASE_OUT,
+        EASE_IN_OUT
+    };
+
+    enum Repeat : u32 {
+        ONCE,
+        LOOP,
+        PING_PONG
+    };
+
+    // Offsets from Sprite::pos at the start and the end
+    glm::vec2 offsetFrom = glm::vec2(0.0f);
+    glm::vec2 offsetTo = glm::vec2(0.0f);
+    // Constant motion in units per second, added to the offset
+    glm::vec2 velocity = glm::vec2(0.0f);
+    // Uniform scale about the sprite's center
+    f32 scaleFrom = 1.0f;
+    f32 scaleTo = 1.0f;
+    // Multiplied with Sprite::color
+    glm::vec4 colorFrom = glm::vec4(1.0f);
+    glm::vec4 colorTo = glm::vec4(1.0f);
+
+    // Seconds on Renderer2D::time(), negative to start when the tween is started.
+    // A duration of 0 never ends, which only makes sense with a velocity.
+    f64 start = -1.0;
+    f32 duration = 0.0f;
+    Easing easing = LINEAR;
+    Repeat repeat = ONCE;
+
+    bool active = false;
+
+    // Progress after easing and seconds of motion at the given time, matching the shader
+    f32 progress(f64 time, f32 *elapsed = nullptr) const;
+    // When a tween repeating ONCE with a duration ends, or infinity
+    f64 end() const;
+};
+
+struct SpriteHandle {
+    static constexpr u32 INVALID = UINT32_MAX;
+
+    u32 index = INVALID;
+    u32 generation = 0;
+
+    bool operator==(const SpriteHandle &other) const;
+    bool operator!=(const SpriteHandle &other) const;
+};
+
 struct Sprite {
+    enum Opacity {
+        OPACITY_AUTO,
+        OPACITY_OPAQUE,
+        OPACITY_TRANSLUCENT
+    };
+
     SpriteBatch *batch = nullptr;
     i32 batchIndex = 0;
 
+    // Set when the sprite lives in a SpritePool
+    SpriteHandle handle;
+
     bool invisible = false;
 
+    // Set on the glyph sprites a Text, NumberText or TextView holds on to
+    bool glyph = false;
+
     glm::vec2 pos;
     glm::vec4 color = glm::vec4(1.0f);
     glm::vec2 size;
     Texture *texture;
     glm::vec4 texCoords = {0.0f, 0.0f, 1.0f, 1.0f};
+    u32 shaderFeatures = 0;
+    f32 layer = 0.0f;
+    Opacity opacity = OPACITY_AUTO;
+
+    // Index from Renderer2D::createClipRect, 0 for none
+    u32 clip = 0;
+
+    // Id from Renderer2D::createMask, 0 for none. A mask shape writes the mask into the stencil buffer
+    // where its texture is opaque instead of drawing; other sprites with the mask only draw inside it.
+    u32 mask = 0;
+    bool maskShape = false;
+
+    // Interpolation state kept by the batch: where the sprite was at the end of the previous tick,
+    // and the position and tick its vertices were last written with
+    glm::vec2 prevPos = glm::vec2(0.0f);
+    glm::vec2 writtenPos = glm::vec2(0.0f);
+    u32 writtenTick = UINT32_MAX;
+
+    // Managed through Renderer2D::startTween and stopTween
+    Tween tween;
 
     Sprite() = default;
     Sprite(glm::vec2 pos, glm::vec2 size, Texture *texture);
@@ -109,28 +391,119 @@ struct Sprite {
     void remove();
 };
 
+// Sprites live in fixed-size chunks, so their addresses never change while they are alive.
+// Handles carry a generation so stale ones are detected after the slot is reused.
+struct SpritePool {
+    static constexpr u32 CHUNK_SIZE = 1024;
+
+    SpritePool(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+    ~SpritePool();
+
+    SpritePool(const SpritePool &other) = delete;
+    SpritePool &operator=(const SpritePool &other) = delete;
+
+    Sprite *create(glm::vec2 pos, glm::vec2 size, Texture *texture);
+    void destroy(Sprite *sprite);
+    void destroy(SpriteHandle handle);
+
+    Sprite *get(SpriteHandle handle);
+    bool contains(const Sprite *sprite) const;
+
+    usize size() const;
+
+    // Live sprites, densely packed in no particular order
+    Sprite **begin();
+    Sprite **end();
+
+    void clear();
+
+private:
+    struct Slot {
+        u32 generation;
+        u32 denseIndex;
+        u32 nextFree;
+    };
+
+    // Snapshots save and restore the slot table as it is
+    friend struct Renderer2D;
+
+    std::pmr::memory_resource *resource;
+    std::pmr::vector<Sprite*> chunks;
+    std::pmr::vector<Slot> slots;
+    std::pmr::vector<Sprite*> dense;
+    std::pmr::vector<u32> denseSlots;
+    u32 freeHead = SpriteHandle::INVALID;
+
+    Sprite *slotSprite(u32 index) const;
+};
+
+// Read-only memory mapping of a whole file. Mappings are cached by path and
+// reference counted, so loading the same file twice shares one mapping.
+struct MappedFile {
+    std::string path;
+    const u8 *data = nullptr;
+    usize size = 0;
+    u32 refCount = 0;
+
+    // Returns nullptr if the file cannot be opened or mapped
+    static MappedFile *acquire(const std::string &path);
+    static void release(MappedFile *file);
+
+private:
+    void *mapping = nullptr;
+};
+
 struct Font {
+    // Keeps the TTF data that info points into alive
+    MappedFile *file = nullptr;
+
     stbtt_fontinfo info;
     Texture texture;
     glm::ivec2 size;
     stbtt_packedchar *packedCharsBuffer = 0;
     i32 packedCharsBufferSize = 0;
     f32 maxHeight = 0.0f;
+    // Glyph bitmap between bake() and upload()
+    u8 *bitmap = nullptr;
 
     Font() = default;
     Font(std::string path);
 
+    // data must stay valid until the font is destroyed
     void createFromTTF(const u8 *data, const usize dataSize);
+    // The two halves of createFromTTF. bake() only touches memory and may run on any thread,
+    // upload() creates the texture and must run on the GL thread.
+    void bake(const u8 *data, const usize dataSize);
+    void upload();
+
+    void destroy();
 
     stbtt_aligned_quad getGlyphQuad(const char c);
     glm::vec4 getGlyphTexCoords(const char c);
 };
 
 struct Text {
+    // Styled span of str, in bytes. Characters outside every run use the text's own font, size and color.
+    struct Run {
+        usize begin;
+        usize end;
+        glm::vec4 color;
+        f32 scale = 1.0f;
+        // nullptr uses the text's font
+        Font *font = nullptr;
+    };
+
     Font *font;
+    SpritePool *pool = nullptr;
 
     std::string str;
-    std::vector<Sprite> sprites;
+    std::pmr::vector<Sprite*> sprites;
+
+    // Sorted by begin, non-overlapping
+    std::pmr::vector<Run> runs;
+
+    // Fonts that markup can select with [font=N]
+    std::pmr::vector<Font*> fonts;
 
     glm::vec2 pos;
     f32 size;
@@ -139,58 +512,493 @@ struct Text {
     bool centered;
 
     Text() = default;
-    Text(Font *font, std::string str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, bool centered);
+    // Without a pool the glyphs are laid out when addText() binds the renderer's pool
+    Text(Font *font, std::string str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, bool centered,
+        SpritePool *pool = nullptr, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // The glyph sprites are owned
+    Text(const Text &other) = delete;
+    Text &operator=(const Text &other) = delete;
 
+    void addRun(usize begin, usize length, glm::vec4 color, f32 scale = 1.0f, Font *font = nullptr);
+    void clearRuns();
+
+    // Replaces str and runs from light markup: [color=#rrggbb], [color=#rrggbbaa], [scale=1.5] and [font=N],
+    // each closed by [/color], [/scale] or [/font] in reverse order. "[[" is a literal bracket.
+    void setMarkup(const std::string &markup);
+
+    // Lays the string out into the existing glyph sprites, creating or releasing sprites as the glyph count changes
     void createSprites();
     void update();
+
+    void destroy();
+};
+
+// Numeric counter that formats straight into a fixed set of glyph sprites. Every character sits in a
+// cell as wide as the widest digit, so a changed digit only rewrites its own sprite.
+struct NumberText {
+    // Digits, sign, decimal point and exponent
+    static constexpr const char *GLYPHS = "0123456789-.e+";
+    static constexpr u32 GLYPH_COUNT = 14;
+
+    Font *font;
+    SpritePool *pool = nullptr;
+
+    // One sprite per cell, all created up front
+    std::pmr::vector<Sprite*> sprites;
+    // Character shown in each cell, 0 when empty
+    std::pmr::vector<char> shown;
+
+    glm::vec2 pos;
+    f32 size;
+    glm::vec4 color;
+    // Digits after the decimal point for floating point values
+    u32 precision;
+
+    NumberText() = default;
+    // Without a pool the cells are created when addNumberText() binds the renderer's pool
+    NumberText(Font *font, glm::vec2 pos, f32 size, glm::vec4 color, u32 precision = 0, u32 capacity = 16,
+        SpritePool *pool = nullptr, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    NumberText(const NumberText &other) = delete;
+    NumberText &operator=(const NumberText &other) = delete;
+
+    // Values longer than the capacity are cut off on the right
+    void set(i64 value);
+    void set(f64 value);
+
+    // Rewrites every cell, for when pos, size or color changed
+    void refresh();
+
+    // Creates the cell sprites once there is a pool
+    void createSprites();
+
+    void destroy();
+
+private:
+    std::array<stbtt_aligned_quad, GLYPH_COUNT> quads;
+    f32 cellWidth = 0.0f;
+
+    void show(const char *chars, usize length);
+    void writeCell(u32 cell, char c);
+};
+
+// Text view for large documents. Line starts are indexed once and only the lines inside the view
+// are laid out; glyph sprites are reused as the view scrolls, so the cost follows what is on screen.
+struct TextView {
+    Font *font;
+    SpritePool *pool = nullptr;
+
+    // Set when the view maps its own file
+    MappedFile *file = nullptr;
+
+    // Not owned
+    const char *data = nullptr;
+    usize dataSize = 0;
+
+    // Start of each line, followed by dataSize + 1
+    std::pmr::vector<usize> lineOffsets;
+    std::pmr::vector<Sprite*> sprites;
+
+    // Top left corner of the view
+    glm::vec2 pos;
+    glm::vec2 viewSize;
+    f32 size;
+    glm::vec4 color;
+    f32 spacing;
+
+    // First visible line, can be fractional
+    f32 scroll = 0.0f;
+
+    TextView() = default;
+    // Without a pool the lines are laid out when addTextView() binds the renderer's pool
+    TextView(Font *font, const char *data, usize dataSize, glm::vec2 pos, glm::vec2 viewSize, f32 size, glm::vec4 color, f32 spacing,
+        SpritePool *pool = nullptr, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+    TextView(Font *font, std::string path, glm::vec2 pos, glm::vec2 viewSize, f32 size, glm::vec4 color, f32 spacing,
+        SpritePool *pool = nullptr, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    TextView(const TextView &other) = delete;
+    TextView &operator=(const TextView &other) = delete;
+
+    // Replaces the viewed text and rebuilds the line index
+    void setText(const char *data, usize dataSize);
+
+    usize lineCount() const;
+    f32 lineHeight() const;
+
+    // Clamped so the last line stays in view
+    void scrollTo(f32 line);
+
+    // Lays out the visible lines
+    void update();
+
+    void destroy();
+};
+
+// Image too large for one texture, baked into fixed-size pages on disk. Pages visible through the camera
+// are read on a worker thread and uploaded into a page cache texture; an indirection table maps every
+// page to the closest resident one, so missing pages show a coarser level until they arrive.
+// Draw it by pointing a sprite's texture at cache.
+struct VirtualTexture {
+    static constexpr u32 MAGIC = 0x31545650;
+    static constexpr u32 MAX_LEVELS = 16;
+
+    struct Header {
+        u32 magic;
+        u32 width;
+        u32 height;
+        u32 pageSize;
+        u32 levels;
+    };
+
+    Header header {};
+
+    // Holds cacheSlots x cacheSlots pages (at most 256 per side, fewer if GL_MAX_TEXTURE_SIZE is smaller),
+    // each with a one texel border for filtering
+    Texture cache;
+    Texture indirection;
+
+    u32 cacheSlots = 0;
+
+    // Pages uploaded per update(), the rest wait for later frames
+    u32 uploadsPerFrame = 8;
+
+    VirtualTexture() = default;
+    VirtualTexture(const std::string &path, u32 cacheSlots = 16);
+    // Only stops the worker, the textures need destroy() while the context is alive
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture &other) = delete;
+    VirtualTexture &operator=(const VirtualTexture &other) = delete;
+
+    // Writes an RGBA8 image and its mip chain as pages. Returns false if the file cannot be written.
+    static bool bake(const u8 *rgba, u32 width, u32 height, u32 pageSize, const std::string &path);
+
+    // Requests the pages of the sprite rectangle (pos, size) that are visible through the camera,
+    // at the level matching their size on screen, and uploads pages that finished loading
+    void update(const Camera &camera, glm::uvec2 viewport, glm::vec2 pos, glm::vec2 size);
+
+    // Binds the indirection table to texture unit 1 and sets the sampling uniforms
+    void bind(ShaderProgram *program);
+
+    u32 residentPages() const;
+
+    void destroy();
+
+private:
+    struct Slot {
+        u64 page;
+        u64 lastUsed;
+        bool used;
+        bool pinned;
+    };
+
+    struct LoadedPage {
+        u64 page;
+        std::vector<u8> data;
+    };
+
+    MappedFile *file = nullptr;
+
+    std::array<glm::uvec2, MAX_LEVELS> levelPages {};
+    std::array<u32, MAX_LEVELS> levelRows {};
+    std::array<usize, MAX_LEVELS> levelOffsets {};
+    u32 indirectionHeight = 0;
+
+    std::vector<Slot> slots;
+    std::unordered_map<u64, u32> resident;
+    std::vector<u8> indirectionData;
+    // Pages made resident or evicted since the indirection table was last written
+    std::vector<u64> changedPages;
+    u64 frame = 0;
+
+    // Reused by update() every frame
+    std::vector<u64> wanted;
+    std::vector<LoadedPage> ready;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<u64> requests;
+    std::vector<LoadedPage> loaded;
+    std::vector<std::vector<u8>> freeBuffers;
+    bool stopping = false;
+
+    static u64 pageKey(u32 level, u32 x, u32 y);
+
+    void stopWorker();
+
+    usize pageBytes() const;
+    const u8 *pageData(u64 page) const;
+
+    void workerLoop();
+    bool upload(u64 page, const u8 *data, bool pinned);
+
+    // Entry of one page: the page itself when resident, otherwise its parent's entry
+    void writeIndirection(u32 level, u32 x, u32 y);
+    void rebuildIndirection();
+    // Rewrites and uploads only the entries under a page that was made resident or evicted
+    void updateIndirection(u64 page);
 };
 
 struct SpriteBatch {
     static constexpr u32 BATCH_SIZE = 10000;
 
+    struct Key {
+        Texture *texture;
+        u32 features;
+        f32 layer;
+        bool opaque;
+        u32 mask;
+        bool maskShape;
+
+        bool operator==(const Key &other) const;
+        bool operator!=(const Key &other) const;
+    };
+
     f32 *data = nullptr;
 
     u32 vao;
     u32 vbo;
 
+    Renderer2D *renderer = nullptr;
     Texture *texture;
     ShaderProgram *shader;
+    u32 features = 0;
+    f32 layer = 0.0f;
+    bool opaque = false;
+    u32 mask = 0;
+    bool maskShape = false;
+
+    // Keeps its sprites ordered by descending y, see Renderer2D::setLayerYSort
+    bool ySorted = false;
+
+    // Assigned every frame from the batch's position in draw order
+    f32 depth = 0.0f;
+
+    // World-space min and max corners of the sprites, only grown by updates until a removal
+    glm::vec4 bounds = glm::vec4(0.0f);
+    // Cleared until a sprite has been written, the next growBounds() starts from that sprite
+    bool boundsValid = false;
+    bool boundsDirty = false;
+
+    // Checked every frame for covering the whole view
+    Sprite *largestSprite = nullptr;
+    f32 largestArea = 0.0f;
+
+    bool occluded = false;
 
     u32 spriteCount = 0;
+    std::pmr::vector<Sprite*> sprites;
+
+    // One bit per slot; updates only set the bit and the vertices are rebuilt once in flushDirty()
+    std::pmr::vector<u64> dirty;
+    bool hasDirty = false;
+
+    // Slots whose vertices changed since the last upload, empty when bufferBegin >= bufferEnd
+    u32 bufferBegin = UINT32_MAX;
+    u32 bufferEnd = 0;
 
-    bool shouldBuffer = false;
+    // Tween attributes, created when the first tweened sprite is written into the batch. Slots without
+    // a tween are zero, which the TWEEN variant leaves untouched.
+    f32 *tweenData = nullptr;
+    u32 tweenVbo = 0;
+    bool shouldBufferTweens = false;
+    // Earliest end of a finite tween in the batch, may be stale after removals
+    f64 nextTweenEnd = INFINITY;
 
     SpriteBatch() = default;
-    SpriteBatch(Texture *texture, ShaderProgram *shader);
+    SpriteBatch(Renderer2D *renderer, const Key &key, ShaderProgram *shader);
+
+    Key key() const;
 
     void addSprite(Sprite *sprite);
     void updateSprite(Sprite *sprite);
     void removeSprite(Sprite *sprite);
 
+    // Includes the sprite in bounds and largestSprite
+    void growBounds(Sprite *sprite);
+
+    void markDirty(Sprite *sprite);
+    void clearDirty(Sprite *sprite);
+    // Rebuilds the vertices of every dirty sprite and returns how many there were
+    u32 flushDirty();
+
+    // Reorders slots and their vertices by descending sprite y. Coherent frames cost a few insertion
+    // sort moves; large changes fall back to a radix sort. Scratch memory comes from the frame arena.
+    // Returns the number of sprites that moved.
+    u32 sortByY();
+
+    // Bakes the end state of every tween that ended by the given time into its sprite
+    void finishTweens(f64 time);
+    // Creates the tween attributes and switches to the TWEEN variant
+    void enableTweens();
+
     bool hasSpace();
 
-    void rawSetVertices(i32 index, f32 *vertices);
+    void rawSetVertices(i32 index, const f32 *vertices);
+    // Widens the range of slots uploaded on the next render
+    void markBuffer(u32 begin, u32 end);
+
+    void recomputeBounds();
 
     void render(const Camera &camera);
 
     void destroy();
 
 private:
+    void writeTween(Sprite *sprite);
     void bufferData();
 };
 
+// Named profiling zones, placed with PHOTON_PROFILE_ZONE when the library is built with PHOTON_PROFILING.
+// Zones count calls and time. With counters enabled on Linux they also sample hardware counters through
+// perf_event_open, which costs two syscalls per zone entry, so compare zones against each other and against
+// earlier runs rather than reading their times as absolute. render() closes a frame for the per-frame report.
+struct Profiler {
+    enum Counter : u32 {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        COUNTER_COUNT
+    };
+
+    struct Sample {
+        u64 calls = 0;
+        u64 nanoseconds = 0;
+        std::array<u64, COUNTER_COUNT> counters {};
+    };
+
+    struct Zone {
+        const char *name;
+        std::atomic<u64> calls;
+        std::atomic<u64> nanoseconds;
+        std::array<std::atomic<u64>, COUNTER_COUNT> counters;
+
+        // Totals when the current frame started and the difference over the last complete frame
+        Sample frameStart;
+        Sample lastFrame;
+
+        Zone(const char *name);
+    };
+
+    struct Report {
+        const char *name;
+        Sample frame;
+        Sample total;
+    };
+
+    // Zones with the same name share their counts
+    static Zone *zone(const char *name);
+
+    // Returns false when the counters cannot be opened, e.g. off Linux or with a restrictive perf_event_paranoid
+    static bool enableCounters();
+    static void disableCounters();
+    static bool countersEnabled();
+
+    static void endFrame();
+    // Zones by descending total time
+    static std::vector<Report> report();
+    // The last frame, or everything since the last reset()
+    static void printReport(std::ostream &out, bool totals = false);
+    static void reset();
+};
+
+struct ProfileScope {
+    ProfileScope(Profiler::Zone *zone);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &other) = delete;
+    ProfileScope &operator=(const ProfileScope &other) = delete;
+
+private:
+    Profiler::Zone *zone;
+    std::chrono::steady_clock::time_point start;
+    std::array<u64, Profiler::COUNTER_COUNT> counters;
+    bool counting = false;
+};
+
+struct FrameStats {
+    // Milliseconds between the starts of the last two frames
+    f32 frameTime = 0.0f;
+    // Milliseconds of GPU time spent on the scaled scene pass, a few frames old
+    f32 sceneGpuTime = 0.0f;
+    f32 resolutionScale = 1.0f;
+
+    u32 drawCalls = 0;
+    u32 sprites = 0;
+
+    // Batches not drawn because an occluder hid them completely
+    u32 skippedBatches = 0;
+    u32 skippedSprites = 0;
+
+    // Sprites whose vertices were rebuilt, however many times each was updated
+    u32 spriteRebuilds = 0;
+    // Sprites moved to keep y-sorted layers in order
+    u32 ySortMoves = 0;
+
+    // Bytes taken from the frame arena during the last render()
+    usize arenaBytes = 0;
+};
+
+struct DynamicResolution {
+    bool enabled = false;
+
+    // Milliseconds of GPU time the scene pass should stay under
+    f32 frameBudget = 1000.0f / 60.0f;
+    f32 minScale = 0.5f;
+    f32 maxScale = 1.0f;
+
+    // Batches on or above uiLayer are drawn after upscaling at native resolution
+    bool nativeUi = false;
+    f32 uiLayer = 100.0f;
+
+    f32 scale = 1.0f;
+
+    void update(f32 sceneTime);
+
+private:
+    f32 averageTime = 0.0f;
+    u32 cooldown = 0;
+};
+
 struct Renderer2D {
-    static constexpr usize VERTEX_SIZE = 8;
+    static constexpr usize VERTEX_SIZE = 12;
     static constexpr usize VERTEX_SIZE_BYTES = VERTEX_SIZE * sizeof(f32);
+    static constexpr usize TWEEN_VERTEX_SIZE = 22;
+    static constexpr usize TWEEN_VERTEX_SIZE_BYTES = TWEEN_VERTEX_SIZE * sizeof(f32);
+
+    // Including the unused index 0
+    static constexpr u32 MAX_CLIP_RECTS = 64;
+    // One stencil value per mask, 0 is unmasked
+    static constexpr u32 MAX_MASKS = 256;
 
     const Window *window;
 
+    // Backs the renderer's long-lived containers and batch vertex storage
+    std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+
+    // Scratch memory for work that only lives for one frame, reset at the end of render()
+    FrameArena frameArena;
+
+    SpritePool spritePool;
+
     ShaderProgram shader;
 
     Camera camera;
 
+    DynamicResolution dynamicResolution;
+    FrameStats stats;
+
+    // Applied in order after the scene is drawn; UI drawn at native resolution is not affected
+    std::vector<PostEffect*> postEffects;
+
+    // Fraction of the current simulation step elapsed at render(), see advanceTick()
+    f32 tickAlpha = 1.0f;
+
     Renderer2D() = default;
-    Renderer2D(const Window *window);
+    Renderer2D(const Window *window, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
     Renderer2D(const Renderer2D &other) = delete;
     Renderer2D(Renderer2D &&other) = delete;
@@ -199,17 +1007,415 @@ struct Renderer2D {
 
     void setClearColor(f32 r, f32 g, f32 b, f32 a);
 
+    ShaderProgram *getShader(u32 features);
+
+    template<u32 Features>
+    ShaderProgram *getShader() {
+        static_assert(ShaderVariant::isValid(Features), "Invalid shader variant");
+        return getShader(Features);
+    }
+
+    u32 spriteFeatures(const Sprite *sprite) const;
+    bool isOpaque(const Sprite *sprite, u32 features) const;
+    SpriteBatch::Key batchKey(const Sprite *sprite) const;
+
     void addSprite(Sprite *sprite);
+    // Adds a sprite whose 6 * VERTEX_SIZE vertices were already built, for example on another thread
+    void addSprite(Sprite *sprite, const f32 *vertices);
+
+    // Allocates a sprite from spritePool and adds it
+    Sprite *createSprite(glm::vec2 pos, glm::vec2 size, Texture *texture);
+    void destroySprite(Sprite *sprite);
+
+    // Level snapshots hold the sprites made with createSprite, the slot table of spritePool and every batch
+    // with its vertices, so loading is a few copies and one upload per batch. Textures are stored as their
+    // index in textures. Loading replaces all batches and pooled sprites; saved handles stay valid.
+    // Clip rects and masks are stored by id and must exist again before drawing. Saving fails if a batch
+    // holds a sprite from another pool. Both fail while text objects hold glyph sprites of spritePool,
+    // which loading would free under them; destroy those first and create them again after loading.
+    bool saveSnapshot(const std::string &path, const std::vector<Texture*> &textures);
+    bool loadSnapshot(const std::string &path, const std::vector<Texture*> &textures);
+
+    // Declares an opaque rectangle (x, y, width, height) in window pixels, origin at the bottom-left,
+    // drawn on the given layer. Batches below it that it fully covers are skipped for the next frame.
+    void addOccluder(glm::vec4 rect, f32 layer);
+
+    // Clip rectangles (x, y, width, height) in world units, referenced by Sprite::clip. The table is uploaded
+    // once per frame and applied in the shader, so sprites with different clips still share a batch.
+    u32 createClipRect(glm::vec4 rect);
+    void setClipRect(u32 index, glm::vec4 rect);
+    void destroyClipRect(u32 index);
+
+    // Clip used by the following immediate-mode draws, 0 for none
+    void setDrawClip(u32 index);
+
+    // Sprites in a y-sorted layer draw from the highest y down, for top-down and isometric scenes.
+    // Sorting happens within each batch, so keep a sorted layer on one texture atlas.
+    void setLayerYSort(f32 layer, bool enabled);
+    bool isLayerYSorted(f32 layer) const;
+
+    // Fixed-step interpolation: call at the start of every simulation step and set tickAlpha before
+    // render(). Sprites moved during the latest step are drawn between their previous and current
+    // positions by the vertex shader, so vertices are only uploaded on ticks.
+    void advanceTick();
+    u32 currentTick() const;
+
+    // Tweens run on the GPU from the time uniform: the sprite's data is uploaded when the tween starts,
+    // and a tween repeating ONCE is baked into the sprite when it ends. Stopping keeps the current state.
+    void startTween(Sprite *sprite, const Tween &tween);
+    void stopTween(Sprite *sprite);
+    // Seconds since the renderer was created, the clock tweens run on
+    f64 time() const;
+
+    // Every mask has its own stencil value, so the stencil buffer is cleared once per frame
+    // no matter how many masks are drawn. Where the shapes of one mask cover another mask whose
+    // content draws on a later layer, the covered mask's shapes are drawn again before that content.
+    u32 createMask();
+    void destroyMask(u32 mask);
     
     void addText(Text *text);
     void updateText(Text *text);
 
+    void addNumberText(NumberText *number);
+
+    void addTextView(TextView *view);
+    void updateTextView(TextView *view);
+
+    // Immediate mode: quads are recorded into frameArena until the next render(), streamed into one buffer
+    // and drawn after the retained batches of the same layer. Consecutive calls with the same texture,
+    // variant and layer share a draw call.
+    void drawQuad(glm::vec2 pos, glm::vec2 size, glm::vec4 color, f32 layer = 0.0f);
+    void drawTexture(Texture *texture, glm::vec2 pos, glm::vec2 size, glm::vec4 texCoords = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+        glm::vec4 color = glm::vec4(1.0f), f32 layer = 0.0f);
+    void drawText(Font *font, std::string_view str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, f32 layer = 0.0f);
+
     void render();
 
     void destroy();
 
 private:
-    std::vector<SpriteBatch*> batches;
+    static constexpr u32 TIMER_QUERY_COUNT = 3;
+
+    struct Occluder {
+        glm::vec4 rect;
+        f32 layer;
+    };
+
+    struct ImmediateRun {
+        Texture *texture;
+        u32 features;
+        f32 layer;
+        u32 first;
+        u32 count;
+        f32 depth;
+    };
+
+    struct PostPass {
+        enum Type {
+            MERGED,
+            BLOOM
+        };
+
+        Type type = MERGED;
+        bool final = false;
+        ShaderProgram *program = nullptr;
+
+        // MERGED: the effects folded into the pass, BLOOM: the bloom effect itself
+        std::vector<PostEffect*> effects;
+        std::vector<i32> paramLocations;
+
+        // MERGED: the bloom pass feeding each composite stage, -1 otherwise
+        std::vector<i32> bloomSources;
+        std::vector<i32> bloomLocations;
+    };
+
+    std::pmr::vector<SpriteBatch*> batches;
+    std::pmr::vector<SpriteBatch*> drawOrder;
+    bool drawOrderDirty = false;
+
+    std::pmr::vector<Occluder> occluders;
+
+    std::pmr::vector<f32> ySortedLayers;
+
+    u32 tick = 0;
+
+    f64 epoch = 0.0;
+    // time() when the frame started, shared by every batch drawn in it
+    f32 frameStart = 0.0f;
+
+    // Min and max corners
+    std::array<glm::vec4, MAX_CLIP_RECTS> clipRects {};
+    u64 clipSlots = 1;
+    u32 clipRectCount = 1;
+    u32 drawClip = 0;
+
+    std::bitset<MAX_MASKS> maskSlots = 1;
+    // Stencil state of the last batch drawn, so runs of batches with the same mask skip the state changes
+    u32 stencilMask = 0;
+    bool stencilShape = false;
+
+    std::pmr::vector<ImmediateRun> immediateRuns;
+    f32 *immediateVertices = nullptr;
+    u32 immediateQuads = 0;
+    u32 immediateCapacity = 0;
+    // Quads recorded last frame, used to size the first block of the next one
+    u32 immediateReserve = 1024;
+    u32 immediateVao = 0;
+    u32 immediateVbo = 0;
+    usize immediateVboSize = 0;
+
+    std::array<ShaderProgram*, ShaderVariant::COUNT> variants {};
+
+    RenderTarget sceneTarget;
+    u32 fullscreenVao = 0;
+
+    RenderTargetPool targetPool;
+    std::vector<PostPass> postPasses;
+    std::vector<RenderTarget*> bloomTargets;
+    u64 postSignature = 0;
+    std::unordered_map<std::string, ShaderProgram*> postPrograms;
+    ShaderProgram bloomExtractShader;
+    ShaderProgram blurShader;
+    std::array<u32, TIMER_QUERY_COUNT> timerQueries {};
+    u32 timerFrame = 0;
+    f64 lastFrameTime = 0.0;
+
+    void sortDrawOrder();
+    void flushDirtySprites();
+    void finishTweens();
+    void sortYSortedBatches();
+    void cullOccludedBatches();
+    void renderBatches(std::pmr::vector<SpriteBatch*>::iterator begin, std::pmr::vector<SpriteBatch*>::iterator end,
+        std::pmr::vector<ImmediateRun>::iterator runBegin, std::pmr::vector<ImmediateRun>::iterator runEnd);
+    void pushImmediateQuad(Texture *texture, u32 features, f32 layer, glm::vec2 pos, glm::vec2 size, glm::vec4 texCoords, glm::vec4 color);
+    void prepareImmediate();
+    void renderImmediate(const ImmediateRun &run);
+    void bindClipRects(ShaderProgram *program, u32 features);
+    void setStencilState(u32 mask, bool shape);
+
+    friend struct SpriteBatch;
+    glm::uvec2 beginOffscreenScene(bool scaled);
+    void endOffscreenScene(bool scaled, glm::uvec2 viewport);
+
+    bool hasActivePostEffects() const;
+    u64 computePostSignature() const;
+    void buildPostPasses();
+    ShaderProgram *getMergedPostProgram(const PostPass &pass);
+    void drawFullscreen(ShaderProgram *program, const Texture &source, glm::vec2 texScale, glm::vec2 texMax);
+};
+
+// Open worlds split into square cells, of which only those near a focus point are in the renderer.
+// The loader fills a cell on a worker thread with decoded images and sprites, whose vertices are built
+// there as well. update() commits finished cells on the GL thread within a time budget, nearest first,
+// and unloads cells that moved out of range.
+struct WorldStreamer {
+    static constexpr u32 NO_IMAGE = UINT32_MAX;
+
+    struct CellSprite {
+        glm::vec2 pos;
+        glm::vec2 size;
+        glm::vec4 color = glm::vec4(1.0f);
+        glm::vec4 texCoords = {0.0f, 0.0f, 1.0f, 1.0f};
+        f32 layer = 0.0f;
+        u32 shaderFeatures = 0;
+        // Index into CellContent::images, or texture for one that is shared between cells
+        u32 image = NO_IMAGE;
+        Texture *texture = nullptr;
+    };
+
+    struct CellContent {
+        std::vector<Image> images;
+        std::vector<CellSprite> sprites;
+    };
+
+    // Runs on a worker thread, so it must not use GL or the renderer
+    typedef std::function<void(glm::ivec2 cell, CellContent &content)> Loader;
+
+    f32 cellSize;
+    // Cells within loadRadius of the focus cell are loaded and stay until they are further than unloadRadius
+    i32 loadRadius = 1;
+    i32 unloadRadius = 2;
+    // Milliseconds of texture uploads and sprite creation per update()
+    f32 commitBudget = 2.0f;
+
+    WorldStreamer(Renderer2D *renderer, f32 cellSize, Loader loader, u32 workerCount = 2);
+    // Only stops the workers, unloading cells needs destroy() while the renderer is alive
+    ~WorldStreamer();
+
+    WorldStreamer(const WorldStreamer &other) = delete;
+    WorldStreamer &operator=(const WorldStreamer &other) = delete;
+
+    void update(glm::vec2 focus);
+
+    glm::ivec2 cellAt(glm::vec2 pos) const;
+    // True once every sprite of the cell is in the renderer
+    bool isLoaded(glm::ivec2 cell) const;
+    usize loadedCells() const;
+    // Cells waiting for a worker, loading or partly committed
+    usize pendingCells() const;
+
+    // Unloads every cell, call before destroying the renderer
+    void destroy();
+
+private:
+    enum CellState {
+        QUEUED,
+        LOADING,
+        READY,
+        LOADED
+    };
+
+    struct Cell {
+        glm::ivec2 coord;
+        CellState state = QUEUED;
+        // Left range while a worker had it, deleted when the worker is done
+        bool discarded = false;
+
+        CellContent content;
+        std::vector<f32> vertices;
+
+        std::vector<Texture> textures;
+        std::vector<SpriteHandle> handles;
+    };
+
+    Renderer2D *renderer;
+    Loader loader;
+
+    std::unordered_map<u64, Cell*> cells;
+    // Finished by workers, committed across updates nearest first
+    std::vector<Cell*> committing;
+    glm::ivec2 focusCell = glm::ivec2(INT32_MAX);
+
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Cell*> requests;
+    std::vector<Cell*> loaded;
+    bool stopping = false;
+
+    static u64 cellKey(glm::ivec2 cell);
+
+    void stopWorkers();
+    void workerLoop();
+    // Returns false when the budget ran out first; progressed is set once anything was committed
+    bool commit(Cell *cell, std::chrono::steady_clock::time_point deadline, bool &progressed);
+    void unload(Cell *cell);
+};
+
+// Loads the resources an app needs at startup. The CPU step of each entry (decoding an image, baking a font)
+// runs on a worker once the CPU steps of its dependencies are done, and update() or finish() run the GL steps
+// on the context thread in manifest order. Dependencies must be added before the entries that use them.
+struct StartupLoader {
+    enum Kind {
+        TEXTURE,
+        FONT,
+        SHADER,
+        TASK
+    };
+
+    struct Timing {
+        std::string name;
+        Kind kind;
+        // Worker that ran the CPU step, counting from 1
+        u32 worker;
+        // Milliseconds since the loader started
+        f64 cpuStart, cpuEnd;
+        f64 glStart, glEnd;
+    };
+
+    typedef std::function<void()> Step;
+
+    // 0 workers uses one per hardware thread besides the GL thread
+    StartupLoader(u32 workerCount = 0);
+    // Only stops the workers, destroy() also frees what never reached the GPU
+    ~StartupLoader();
+
+    StartupLoader(const StartupLoader &other) = delete;
+    StartupLoader &operator=(const StartupLoader &other) = delete;
+
+    // The loader fills the given objects, which must stay alive until it is done
+    void addTexture(const std::string &name, Texture *texture, const std::string &path, Texture::TextureType type,
+        const std::vector<std::string> &dependencies = {});
+    void addFont(const std::string &name, Font *font, const std::string &path, const std::vector<std::string> &dependencies = {});
+    void addShader(const std::string &name, ShaderProgram *program, std::string vertexSource, std::string fragmentSource,
+        const std::vector<std::string> &dependencies = {});
+    // Compiles a renderer shader variant before its first sprite needs it
+    void addShaderVariant(const std::string &name, Renderer2D *renderer, u32 features, const std::vector<std::string> &dependencies = {});
+    // cpu runs on a worker and gl on the context thread, either may be empty
+    void addTask(const std::string &name, Step cpu, Step gl, const std::vector<std::string> &dependencies = {});
+
+    // Runs GL steps for up to budget milliseconds without waiting on the workers, so a loading screen can be
+    // drawn between calls. At least one ready step runs per call. Returns true once everything is loaded.
+    bool update(f32 budget);
+    // Blocks until everything is loaded
+    void finish();
+
+    bool isDone() const;
+    usize loadedCount() const;
+    usize count() const;
+
+    std::vector<Timing> timeline() const;
+    // Per entry timings, the wall time and the time the same work takes in sequence
+    void printTimeline(std::ostream &out) const;
+
+    // Stops the workers and frees CPU results that never reached the GPU
+    void destroy();
+
+private:
+    struct Entry {
+        std::string name;
+        Kind kind;
+        Step cpu;
+        Step gl;
+        std::vector<usize> dependencies;
+        std::vector<usize> dependents;
+        // Dependencies whose CPU step has not finished yet
+        usize pendingCpu = 0;
+        bool cpuDone = false;
+        bool glDone = false;
+
+        Image image;
+        Font *font = nullptr;
+
+        u32 worker = 0;
+        f64 cpuStart = 0.0, cpuEnd = 0.0;
+        f64 glStart = 0.0, glEnd = 0.0;
+    };
+
+    u32 workerCount;
+    // A deque keeps entries in place for the steps that point at them
+    std::deque<Entry> entries;
+    std::unordered_map<std::string, usize> names;
+    // Every entry before it has finished its GL step
+    usize firstPending = 0;
+    usize loaded = 0;
+
+    bool started = false;
+    std::chrono::steady_clock::time_point startTime;
+
+    std::vector<std::thread> workers;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<usize> ready;
+    bool stopping = false;
+
+    Entry &add(const std::string &name, Kind kind, const std::vector<std::string> &dependencies);
+    f64 elapsed() const;
+    void start();
+    void stopWorkers();
+    bool run(std::chrono::steady_clock::time_point deadline, bool wait);
+    // Called with the mutex held
+    Entry *nextUpload();
+    void workerLoop(u32 worker);
 };
 
-}
\ No newline at end of file
+}
+
+#ifdef PHOTON_PROFILING
+// At most one zone per scope
+#define PHOTON_PROFILE_ZONE(name) \
+    static photon::Profiler::Zone *photonProfileZone = photon::Profiler::zone(name); \
+    photon::ProfileScope photonProfileScope(photonProfileZone)
+#else
+#define PHOTON_PROFILE_ZONE(name)
+#endif
@@ -3,35 +3,424 @@
 #include <glad/glad.h>
 #include <stb_image/stb_image.h>
 #include <stb_truetype/stb_truetype.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <mutex>
 #include <glm/gtc/matrix_transform.hpp>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 const char *vertexShaderSource =
-    "#version 330 core\n"
-    "in vec2 aPos;\n"
-    "in vec4 aColor;\n"
-    "in vec2 aTexCoord;\n"
+    "layout(location = 0) in vec2 aPos;\n"
+    "layout(location = 1) in vec4 aColor;\n"
+    "layout(location = 2) in vec2 aTexCoord;\n"
+    "layout(location = 3) in float aClip;\n"
+    "layout(location = 4) in vec2 aPrevPos;\n"
+    "layout(location = 5) in float aTick;\n"
+    "#ifdef TWEEN\n"
+    "layout(location = 6) in vec4 aTweenTime;\n"
+    "layout(location = 7) in vec4 aTweenMove;\n"
+    "layout(location = 8) in vec4 aTweenMotion;\n"
+    "layout(location = 9) in vec2 aTweenCorner;\n"
+    "layout(location = 10) in vec4 aTweenColorFrom;\n"
+    "layout(location = 11) in vec4 aTweenColorTo;\n"
+    "uniform float uTime;\n"
+    "float ease(float t, float easing) {\n"
+    "   if(easing < 0.5) return t;\n"
+    "   if(easing < 1.5) return t * t;\n"
+    "   if(easing < 2.5) return t * (2.0 - t);\n"
+    "   return t < 0.5 ? 2.0 * t * t : 1.0 - 2.0 * (1.0 - t) * (1.0 - t);\n"
+    "}\n"
+    "#endif\n"
     "out vec4 vColor;\n"
     "out vec2 vTexCoord;\n"
+    "#ifdef CLIP\n"
+    "flat out int vClip;\n"
+    "out vec2 vWorldPos;\n"
+    "#endif\n"
     "uniform mat4 uProj;\n"
     "uniform mat4 uView;\n"
+    "uniform float uDepth;\n"
+    "uniform float uTick;\n"
+    "uniform float uAlpha = 1.0;\n"
     "void main() {\n"
-    "   gl_Position = uProj * uView * vec4(aPos, 0.0, 1.0);\n"
+    "   vec2 pos = abs(aTick - uTick) < 0.5 ? mix(aPrevPos, aPos, uAlpha) : aPos;\n"
     "   vColor = aColor;\n"
+    "#ifdef TWEEN\n"
+    "   float elapsed = max(uTime - aTweenTime.x, 0.0);\n"
+    "   float t = 0.0;\n"
+    "   if(aTweenTime.y > 0.0) {\n"
+    "       t = elapsed / aTweenTime.y;\n"
+    "       t = aTweenTime.w > 1.5 ? 1.0 - abs(mod(t, 2.0) - 1.0) : aTweenTime.w > 0.5 ? fract(t) : min(t, 1.0);\n"
+    "       elapsed = aTweenTime.w > 0.5 ? elapsed : min(elapsed, aTweenTime.y);\n"
+    "   }\n"
+    "   t = ease(t, aTweenTime.z);\n"
+    "   pos += mix(aTweenMove.xy, aTweenMove.zw, t) + aTweenMotion.xy * elapsed + mix(aTweenMotion.z, aTweenMotion.w, t) * aTweenCorner;\n"
+    "   vColor *= 1.0 + mix(aTweenColorFrom, aTweenColorTo, t);\n"
+    "#endif\n"
+    "   gl_Position = uProj * uView * vec4(pos, 0.0, 1.0);\n"
+    "   gl_Position.z = uDepth * gl_Position.w;\n"
     "   vTexCoord = aTexCoord;\n"
+    "#ifdef CLIP\n"
+    "   vClip = int(aClip);\n"
+    "   vWorldPos = pos;\n"
+    "#endif\n"
     "}\n";
 
 const char *fragmentShaderSource =
-    "#version 330 core\n"
     "in vec4 vColor;\n"
     "in vec2 vTexCoord;\n"
     "out vec4 color;\n"
+    "#ifndef UNTEXTURED\n"
+    "uniform sampler2D uTexture;\n"
+    "#endif\n"
+    "#ifdef VIRTUAL\n"
+    "uniform usampler2D uIndirection;\n"
+    "uniform vec2 uVirtualSize;\n"
+    "uniform float uPageSize;\n"
+    "uniform float uCacheSlots;\n"
+    "uniform int uLevelCount;\n"
+    "uniform int uLevelRows[16];\n"
+    "vec2 levelSize(int level) {\n"
+    "   return max(floor(uVirtualSize / exp2(float(level))), vec2(1.0));\n"
+    "}\n"
+    "vec4 sampleVirtual(vec2 uv) {\n"
+    "   vec2 texels = uv * uVirtualSize;\n"
+    "   vec2 dx = dFdx(texels);\n"
+    "   vec2 dy = dFdy(texels);\n"
+    "   float lod = max(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0);\n"
+    "   int level = min(int(lod), uLevelCount - 1);\n"
+    "   uv = clamp(uv, 0.0, 0.99999);\n"
+    "   ivec2 page = ivec2(uv * levelSize(level) / uPageSize);\n"
+    "   uvec4 entry = texelFetch(uIndirection, ivec2(page.x, page.y + uLevelRows[level]), 0);\n"
+    "   vec2 inPage = fract(uv * levelSize(int(entry.b)) / uPageSize);\n"
+    "   float slotSize = uPageSize + 2.0;\n"
+    "   vec2 cacheUv = (vec2(entry.rg) * slotSize + 1.0 + inPage * uPageSize) / (uCacheSlots * slotSize);\n"
+    "   return textureLod(uTexture, cacheUv, 0.0);\n"
+    "}\n"
+    "#endif\n"
+    "#ifdef CLIP\n"
+    "flat in int vClip;\n"
+    "in vec2 vWorldPos;\n"
+    "uniform vec4 uClipRects[MAX_CLIP_RECTS];\n"
+    "#endif\n"
+    "const float ALPHA_CUTOFF = 0.5;\n"
+    "void main() {\n"
+    "#ifdef CLIP\n"
+    "   vec4 clipRect = uClipRects[vClip];\n"
+    "   if(vClip > 0 && (any(lessThan(vWorldPos, clipRect.xy)) || any(greaterThanEqual(vWorldPos, clipRect.zw)))) {\n"
+    "       discard;\n"
+    "   }\n"
+    "#endif\n"
+    "#ifdef PREMULTIPLIED\n"
+    "   vec4 tint = vec4(vColor.rgb * vColor.a, vColor.a);\n"
+    "#else\n"
+    "   vec4 tint = vColor;\n"
+    "#endif\n"
+    "#if defined(UNTEXTURED)\n"
+    "   color = tint;\n"
+    "#elif defined(SDF) || defined(GRAYSCALE)\n"
+    "   float coverage = texture(uTexture, vTexCoord).r;\n"
+    "#ifdef SDF\n"
+    "   float width = fwidth(coverage);\n"
+    "   coverage = smoothstep(0.5 - width, 0.5 + width, coverage);\n"
+    "#endif\n"
+    "#ifdef PREMULTIPLIED\n"
+    "   color = tint * coverage;\n"
+    "#else\n"
+    "   color = vec4(tint.rgb, tint.a * coverage);\n"
+    "#endif\n"
+    "#elif defined(VIRTUAL)\n"
+    "   color = tint * sampleVirtual(vTexCoord);\n"
+    "#else\n"
+    "   color = tint * texture(uTexture, vTexCoord);\n"
+    "#endif\n"
+    "#ifdef ALPHA_TEST\n"
+    "   if(color.a < ALPHA_CUTOFF) {\n"
+    "       discard;\n"
+    "   }\n"
+    "#endif\n"
+    "}\n";
+
+const char *fullscreenVertexShaderSource =
+    "#version 330 core\n"
+    "out vec2 vTexCoord;\n"
+    "out vec2 vUv;\n"
+    "uniform vec2 uTexScale;\n"
+    "void main() {\n"
+    "   vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "   vTexCoord = position * uTexScale;\n"
+    "   vUv = position;\n"
+    "   gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+const char *bloomExtractFragmentShaderSource =
+    "#version 330 core\n"
+    "in vec2 vTexCoord;\n"
+    "out vec4 color;\n"
     "uniform sampler2D uTexture;\n"
+    "uniform vec2 uTexMax;\n"
+    "uniform float uThreshold;\n"
     "void main() {\n"
-    "   color = vColor * texture(uTexture, vTexCoord);\n"
+    "   vec3 source = texture(uTexture, min(vTexCoord, uTexMax)).rgb;\n"
+    "   float brightness = max(source.r, max(source.g, source.b));\n"
+    "   color = vec4(source * max(brightness - uThreshold, 0.0) / max(brightness, 0.0001), 1.0);\n"
     "}\n";
 
+const char *blurFragmentShaderSource =
+    "#version 330 core\n"
+    "in vec2 vTexCoord;\n"
+    "out vec4 color;\n"
+    "uniform sampler2D uTexture;\n"
+    "uniform vec2 uDirection;\n"
+    "void main() {\n"
+    "   vec3 sum = texture(uTexture, vTexCoord).rgb * 0.2270270270;\n"
+    "   sum += texture(uTexture, vTexCoord + uDirection * 1.3846153846).rgb * 0.3162162162;\n"
+    "   sum += texture(uTexture, vTexCoord - uDirection * 1.3846153846).rgb * 0.3162162162;\n"
+    "   sum += texture(uTexture, vTexCoord + uDirection * 3.2307692308).rgb * 0.0702702703;\n"
+    "   sum += texture(uTexture, vTexCoord - uDirection * 3.2307692308).rgb * 0.0702702703;\n"
+    "   color = vec4(sum, 1.0);\n"
+    "}\n";
+
+static const char *shaderFeatureNames[photon::ShaderVariant::FEATURE_COUNT] = {
+    "UNTEXTURED",
+    "GRAYSCALE",
+    "ALPHA_TEST",
+    "PREMULTIPLIED",
+    "SDF",
+    "CLIP",
+    "VIRTUAL",
+    "TWEEN"
+};
+
+static std::string postStageCode(const photon::PostEffect *effect, usize stage) {
+    switch(effect->type) {
+    case photon::PostEffect::COLOR_GRADING:
+        return
+            "       color.rgb *= exp2(params.x);\n"
+            "       color.rgb = (color.rgb - 0.5) * params.y + 0.5;\n"
+            "       color.rgb = mix(vec3(dot(color.rgb, vec3(0.2126, 0.7152, 0.0722))), color.rgb, params.z);\n";
+    case photon::PostEffect::VIGNETTE:
+        return "       color.rgb *= 1.0 - params.x * smoothstep(params.y - params.z, params.y, distance(uv, vec2(0.5)));\n";
+    case photon::PostEffect::BLOOM:
+        return "       color.rgb += texture(uBloom" + std::to_string(stage) + ", uv).rgb * params.y;\n";
+    default:
+        return effect->code + "\n";
+    }
+}
+
+static std::string buildShaderSource(const char *body, u32 features) {
+    std::string source = "#version 330 core\n";
+
+    for(u32 i = 0; i < photon::ShaderVariant::FEATURE_COUNT; i++) {
+        if(features & (1u << i)) {
+            source += "#define ";
+            source += shaderFeatureNames[i];
+            source += "\n";
+        }
+    }
+
+    if(features & photon::ShaderVariant::CLIP) {
+        source += "#define MAX_CLIP_RECTS " + std::to_string(photon::Renderer2D::MAX_CLIP_RECTS) + "\n";
+    }
+
+    return source + body;
+}
+
+static const f32 zeroVertices[photon::Renderer2D::VERTEX_SIZE * 6] = {};
+
+// Ticks are compared as floats in the shader, so only the low 24 bits are stored
+static f32 tickStamp(u32 tick) {
+    return (f32) (tick & 0xffffff);
+}
+
+static void writeQuadVertices(f32 *vertices, glm::vec2 pos, glm::vec2 prevPos, glm::vec2 size, glm::vec4 texCoords, glm::vec4 color, u32 clip, u32 tick) {
+    const f32 c = (f32) clip;
+    const f32 t = tickStamp(tick);
+    const f32 quad[] = {
+        pos.x, pos.y, color.r, color.g, color.b, color.a, texCoords.x, texCoords.w, c, prevPos.x, prevPos.y, t,
+        pos.x + size.x, pos.y, color.r, color.g, color.b, color.a, texCoords.z, texCoords.w, c, prevPos.x + size.x, prevPos.y, t,
+        pos.x + size.x, pos.y + size.y, color.r, color.g, color.b, color.a, texCoords.z, texCoords.y, c, prevPos.x + size.x, prevPos.y + size.y, t,
+        pos.x + size.x, pos.y + size.y, color.r, color.g, color.b, color.a, texCoords.z, texCoords.y, c, prevPos.x + size.x, prevPos.y + size.y, t,
+        pos.x, pos.y + size.y, color.r, color.g, color.b, color.a, texCoords.x, texCoords.y, c, prevPos.x, prevPos.y + size.y, t,
+        pos.x, pos.y, color.r, color.g, color.b, color.a, texCoords.x, texCoords.w, c, prevPos.x, prevPos.y, t,
+    };
+
+    std::memcpy(vertices, quad, sizeof(quad));
+}
+
+// Matches the attribute locations in vertexShaderSource, for the currently bound VAO and buffer
+static void setSpriteVertexAttributes() {
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) (2 * sizeof(f32)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) (6 * sizeof(f32)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) (8 * sizeof(f32)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) (9 * sizeof(f32)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, photon::Renderer2D::VERTEX_SIZE_BYTES, (void*) (11 * sizeof(f32)));
+    glEnableVertexAttribArray(5);
+}
+
+static void setTweenVertexAttributes() {
+    const u32 sizes[] = {4, 4, 4, 2, 4, 4};
+    usize offset = 0;
+
+    for(u32 i = 0; i < 6; i++) {
+        glVertexAttribPointer(6 + i, sizes[i], GL_FLOAT, GL_FALSE, photon::Renderer2D::TWEEN_VERTEX_SIZE_BYTES, (void*) (offset * sizeof(f32)));
+        glEnableVertexAttribArray(6 + i);
+        offset += sizes[i];
+    }
+}
+
+// Scale and color are stored relative to 1 so a zeroed block is no tween at all
+static void writeTweenVertices(f32 *vertices, const photon::Tween &tween, f32 start, glm::vec2 size) {
+    const glm::vec2 corners[] = {
+        {-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}, {-0.5f, -0.5f}
+    };
+
+    for(u32 i = 0; i < 6; i++) {
+        glm::vec2 corner = corners[i] * size;
+        glm::vec4 colorFrom = tween.colorFrom - 1.0f;
+        glm::vec4 colorTo = tween.colorTo - 1.0f;
+        const f32 vertex[] = {
+            start, tween.duration, (f32) tween.easing, (f32) tween.repeat,
+            tween.offsetFrom.x, tween.offsetFrom.y, tween.offsetTo.x, tween.offsetTo.y,
+            tween.velocity.x, tween.velocity.y, tween.scaleFrom - 1.0f, tween.scaleTo - 1.0f,
+            corner.x, corner.y,
+            colorFrom.r, colorFrom.g, colorFrom.b, colorFrom.a,
+            colorTo.r, colorTo.g, colorTo.b, colorTo.a
+        };
+
+        std::memcpy(&vertices[i * photon::Renderer2D::TWEEN_VERTEX_SIZE], vertex, sizeof(vertex));
+    }
+}
+
+static f32 easeTween(f32 t, photon::Tween::Easing easing) {
+    switch(easing) {
+    case photon::Tween::EASE_IN:
+        return t * t;
+    case photon::Tween::EASE_OUT:
+        return t * (2.0f - t);
+    case photon::Tween::EASE_IN_OUT:
+        return t < 0.5f ? 2.0f * t * t : 1.0f - 2.0f * (1.0f - t) * (1.0f - t);
+    default:
+        return t;
+    }
+}
+
+static bool isFullyOpaque(const u8 *data, u32 width, u32 height, photon::Texture::TextureType type) {
+    if(type == photon::Texture::RGB) {
+        return true;
+    } else if(type == photon::Texture::RED || !data) {
+        return false;
+    }
+
+    const usize pixelCount = (usize) width * height;
+
+    for(usize i = 0; i < pixelCount; i++) {
+        if(data[i * 4 + 3] != 255) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+photon::FrameArena::FrameArena(usize capacity, std::pmr::memory_resource *upstream) : upstream(upstream), bufferCapacity(capacity) {
+    buffer = (u8*) upstream->allocate(bufferCapacity, alignof(std::max_align_t));
+}
+
+photon::FrameArena::~FrameArena() {
+    reset();
+    upstream->deallocate(buffer, bufferCapacity, alignof(std::max_align_t));
+}
+
+void photon::FrameArena::reset() {
+    usize required = offset + overflowBytes;
+
+    while(overflow) {
+        OverflowBlock *next = overflow->next;
+        upstream->deallocate(overflow, overflow->size, overflow->alignment);
+        overflow = next;
+    }
+
+    if(required > bufferCapacity) {
+        upstream->deallocate(buffer, bufferCapacity, alignof(std::max_align_t));
+        bufferCapacity = required + required / 2;
+        buffer = (u8*) upstream->allocate(bufferCapacity, alignof(std::max_align_t));
+    }
+
+    offset = 0;
+    overflowBytes = 0;
+}
+
+usize photon::FrameArena::used() const {
+    return offset + overflowBytes;
+}
+
+usize photon::FrameArena::capacity() const {
+    return bufferCapacity;
+}
+
+void *photon::FrameArena::do_allocate(usize bytes, usize alignment) {
+    // The buffer itself is only aligned to max_align_t, so align the address rather than the offset
+    uintptr_t base = (uintptr_t) buffer;
+    usize start = (usize) (((base + offset + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base);
+
+    if(start + bytes <= bufferCapacity) {
+        offset = start + bytes;
+        return buffer + start;
+    }
+
+    // Out of space until the next reset, fall back to the upstream resource for this frame
+    usize blockAlignment = std::max(alignment, alignof(OverflowBlock));
+    usize headerSize = (sizeof(OverflowBlock) + blockAlignment - 1) & ~(blockAlignment - 1);
+    usize size = headerSize + bytes;
+
+    OverflowBlock *block = (OverflowBlock*) upstream->allocate(size, blockAlignment);
+    block->next = overflow;
+    block->size = size;
+    block->alignment = blockAlignment;
+    overflow = block;
+    overflowBytes += bytes + alignment;
+
+    return (u8*) block + headerSize;
+}
+
+// Individual frees are ignored, reset() releases everything at once
+void photon::FrameArena::do_deallocate(void *, usize, usize) {
+
+}
+
+bool photon::FrameArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
 static void glfwErrorCallback(i32 err, const char *msg) {
     std::cerr << "GLFW Error (" << err << "): " << msg << std::endl;
     std::exit(-1);
@@ -50,6 +439,37 @@ static void glfwKeyCallback(GLFWwindow *w, i32 key, i32 scancode, i32 action, i3
     }
 }
 
+// KHR_parallel_shader_compile and its ARB twin are not in the bundled glad
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+static bool parallelShaderCompile = false;
+
+static void loadParallelShaderCompile() {
+    const char *functionName = nullptr;
+
+    if(glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+        functionName = "glMaxShaderCompilerThreadsKHR";
+    } else if(glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+        functionName = "glMaxShaderCompilerThreadsARB";
+    }
+
+    if(!functionName) {
+        return;
+    }
+
+    parallelShaderCompile = true;
+
+    // Let the driver pick its thread count instead of its possibly conservative default
+    auto maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) glfwGetProcAddress(functionName);
+
+    if(maxShaderCompilerThreads) {
+        maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+}
+
 photon::Window::Window(std::string name, u32 width, u32 height, bool resizable) : dimensions(width, height) {
     glfwSetErrorCallback(glfwErrorCallback);
 
@@ -60,8 +480,10 @@ photon::Window::Window(std::string name, u32 width, u32 height, bool resizable)
 
     glfwWindowHint(GLFW_RESIZABLE, resizable ? GLFW_TRUE : GLFW_FALSE);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
     handle = glfwCreateWindow(width, height, name.c_str(), nullptr, nullptr);
 
     if(!handle) {
@@ -79,6 +501,8 @@ photon::Window::Window(std::string name, u32 width, u32 height, bool resizable)
         std::cerr << "Failed to load OpenGL" << std::endl;
         std::exit(-1);
     }
+
+    loadParallelShaderCompile();
 }
 
 void photon::Window::destroy() {
@@ -103,51 +527,75 @@ bool photon::Window::isKeyDown(i32 key) {
 }
 
 photon::ShaderProgram::ShaderProgram(std::string vertexSource, std::string fragmentSource) {
-    i32 vertexHandle = glCreateShader(GL_VERTEX_SHADER);
-    i32 fragmentHandle = glCreateShader(GL_FRAGMENT_SHADER);
+    vertexHandle = glCreateShader(GL_VERTEX_SHADER);
+    fragmentHandle = glCreateShader(GL_FRAGMENT_SHADER);
 
     const char *vertexSourcePtr = vertexSource.c_str();
     const char *fragmentSourcePtr = fragmentSource.c_str();
 
+    glShaderSource(vertexHandle, 1, &vertexSourcePtr, nullptr);
+    glCompileShader(vertexHandle);
+
+    glShaderSource(fragmentHandle, 1, &fragmentSourcePtr, nullptr);
+    glCompileShader(fragmentHandle);
+
+    handle = glCreateProgram();
+    glAttachShader(handle, vertexHandle);
+    glAttachShader(handle, fragmentHandle);
+    glLinkProgram(handle);
+}
+
+bool photon::ShaderProgram::isReady() {
+    if(!vertexHandle) {
+        return true;
+    }
+
+    if(parallelShaderCompile) {
+        i32 completed;
+        glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &completed);
+
+        if(completed == GL_FALSE) {
+            return false;
+        }
+    }
+
+    checkStatus();
+    return true;
+}
+
+void photon::ShaderProgram::checkStatus() {
     i32 result;
     i32 logLength;
 
-    glShaderSource(vertexHandle, 1, &vertexSourcePtr, nullptr);
-    glCompileShader(vertexHandle);
+    // Info logs are only read on failure and usually fit on the stack
+    char logBuffer[1024];
+    std::pmr::monotonic_buffer_resource logResource(logBuffer, sizeof(logBuffer));
 
     glGetShaderiv(vertexHandle, GL_COMPILE_STATUS, &result);
     glGetShaderiv(vertexHandle, GL_INFO_LOG_LENGTH, &logLength);
 
     if(result == GL_FALSE) {
-        std::vector<char> error(logLength + 1);
+        std::pmr::vector<char> error(logLength + 1, &logResource);
         glGetShaderInfoLog(vertexHandle, logLength, nullptr, error.data());
         std::cerr << "Failed to compile vertex shader: " << error.data() << std::endl;
         std::exit(-1);
     }
 
-    glShaderSource(fragmentHandle, 1, &fragmentSourcePtr, nullptr);
-    glCompileShader(fragmentHandle);
-
     glGetShaderiv(fragmentHandle, GL_COMPILE_STATUS, &result);
     glGetShaderiv(fragmentHandle, GL_INFO_LOG_LENGTH, &logLength);
 
     if(result == GL_FALSE) {
-        std::vector<char> error(logLength + 1);
+        std::pmr::vector<char> error(logLength + 1, &logResource);
         glGetShaderInfoLog(fragmentHandle, logLength, nullptr, error.data());
         std::cerr << "Failed to compile fragment shader: " << error.data() << std::endl;
         std::exit(-1);
     }
 
-    handle = glCreateProgram();
-    glAttachShader(handle, vertexHandle);
-    glAttachShader(handle, fragmentHandle);
-    glLinkProgram(handle);
-
     glGetProgramiv(handle, GL_LINK_STATUS, &result);
     glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &logLength);
 
     if(logLength > 0) {
-        std::vector<char> error(logLength + 1);
+        std::pmr::vector<char> error(logLength + 1, &logResource);
         glGetProgramInfoLog(handle, logLength, nullptr, error.data());
         std::cerr << "Failed to link program: " << error.data() << std::endl;
         std::exit(-1);
@@ -158,26 +606,57 @@ photon::ShaderProgram::ShaderProgram(std::string vertexSource, std::string fragm
 
     glDeleteShader(vertexHandle);
     glDeleteShader(fragmentHandle);
+
+    vertexHandle = 0;
+    fragmentHandle = 0;
 }
 
 void photon::ShaderProgram::bind() {
+    if(vertexHandle) {
+        checkStatus();
+    }
+
     glUseProgram(handle);
 }
 
-void photon::ShaderProgram::setInt(std::string location, i32 value) {
-    glUniform1i(glGetUniformLocation(handle, location.c_str()), value);
+void photon::ShaderProgram::setInt(const char *location, i32 value) {
+    glUniform1i(glGetUniformLocation(handle, location), value);
+}
+
+void photon::ShaderProgram::setFloat(const char *location, f32 value) {
+    glUniform1f(glGetUniformLocation(handle, location), value);
 }
 
-void photon::ShaderProgram::setFloat(std::string location, f32 value) {
-    glUniform1f(glGetUniformLocation(handle, location.c_str()), value);
+void photon::ShaderProgram::setVec2(const char *location, glm::vec2 value) {
+    glUniform2fv(glGetUniformLocation(handle, location), 1, &value[0]);
 }
 
-void photon::ShaderProgram::setVec2(std::string location, glm::vec2 value) {
-    glUniform2fv(glGetUniformLocation(handle, location.c_str()), 1, &value[0]);
+void photon::ShaderProgram::setVec4Array(const char *location, const glm::vec4 *values, u32 count) {
+    glUniform4fv(glGetUniformLocation(handle, location), count, &values[0][0]);
 }
 
-void photon::ShaderProgram::setMat4(std::string location, glm::mat4 value) {
-    glUniformMatrix4fv(glGetUniformLocation(handle, location.c_str()), 1, GL_FALSE, &value[0][0]);
+void photon::ShaderProgram::setMat4(const char *location, glm::mat4 value) {
+    glUniformMatrix4fv(glGetUniformLocation(handle, location), 1, GL_FALSE, &value[0][0]);
+}
+
+void photon::ShaderProgram::setInt(const std::string &location, i32 value) {
+    setInt(location.c_str(), value);
+}
+
+void photon::ShaderProgram::setFloat(const std::string &location, f32 value) {
+    setFloat(location.c_str(), value);
+}
+
+void photon::ShaderProgram::setVec2(const std::string &location, glm::vec2 value) {
+    setVec2(location.c_str(), value);
+}
+
+void photon::ShaderProgram::setVec4Array(const std::string &location, const glm::vec4 *values, u32 count) {
+    setVec4Array(location.c_str(), values, count);
+}
+
+void photon::ShaderProgram::setMat4(const std::string &location, glm::mat4 value) {
+    setMat4(location.c_str(), value);
 }
 
 photon::Texture::Texture(u8 *data, u32 width, u32 height, TextureType type) : type(type) {
@@ -196,388 +675,4862 @@ photon::Texture::Texture(u8 *data, u32 width, u32 height, TextureType type) : ty
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    opaque = isFullyOpaque(data, width, height, type);
+}
+
+photon::Texture::Texture(std::string path, TextureType type) {
+    Image image(path, type);
+    *this = Texture(image);
+    image.destroy();
 }
 
-photon::Texture::Texture(std::string path, TextureType type) : type(type) {
+photon::Texture::Texture(const Image &image) : type(image.type) {
     glGenTextures(1, &handle);
     bind();
 
-    i32 width, height, channels;
-    u8 *data;
-
-    if(type == RGB) {
-        data = stbi_load(path.c_str(), &width, &height, &channels, 3);
-    } else if(type == RGBA) {
-        data = stbi_load(path.c_str(), &width, &height, &channels, 4);
-    } else if(type == RED) {
-        data = stbi_load(path.c_str(), &width, &height, &channels, 1);
-    }
-
-    if(!data) {
-        std::cerr << "Failed to load image " << path << std::endl;
-        std::exit(-1);
-    }
-
-    if(type == RGB) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    } else if(type == RGBA) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    } else if(type == RED) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
-    }
+    GLenum format = type == RGBA ? GL_RGBA : type == RGB ? GL_RGB : GL_RED;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    stbi_image_free(data);
+    opaque = image.opaque;
 }
 
 void photon::Texture::bind() {
     glBindTexture(GL_TEXTURE_2D, handle);
 }
 
+void photon::Texture::destroy() {
+    glDeleteTextures(1, &handle);
+}
+
 void photon::Texture::activate(u8 index) {
     glActiveTexture(GL_TEXTURE0 + index);
 }
 
-photon::Sprite::Sprite(glm::vec2 pos, glm::vec2 size, photon::Texture *texture) : pos(pos), size(size), texture(texture) {
-
+static u32 channelCount(photon::Texture::TextureType type) {
+    return type == photon::Texture::RGBA ? 4 : type == photon::Texture::RGB ? 3 : 1;
 }
 
-bool photon::Sprite::isAdded() {
-    return batch != nullptr;
+static u32 readU32(const u8 *bytes) {
+    return (u32) bytes[0] | (u32) bytes[1] << 8 | (u32) bytes[2] << 16 | (u32) bytes[3] << 24;
 }
 
-void photon::Sprite::update() {
-    if(isAdded()) {
-        batch->updateSprite(this);
+static void writeU32(std::vector<u8> &out, u32 value) {
+    for(u32 i = 0; i < 4; i++) {
+        out.push_back((u8) (value >> (i * 8)));
     }
 }
 
-void photon::Sprite::toggleInvisibility() {
-    if(isAdded()) {
-        if(invisible) {
-            update();
-            invisible = false;
+// Same weights as stb_image, so a single channel load looks alike in every format
+static u8 luminance(const u8 *pixel) {
+    return (u8) ((pixel[0] * 77 + pixel[1] * 150 + pixel[2] * 29) >> 8);
+}
+
+static void convertChannels(const u8 *in, u32 from, u8 *out, u32 to, usize pixelCount) {
+    for(usize i = 0; i < pixelCount; i++, in += from, out += to) {
+        if(to == 1) {
+            out[0] = from == 1 ? in[0] : luminance(in);
         } else {
-            float *vertices = (float*) std::calloc(Renderer2D::VERTEX_SIZE * 6, sizeof(f32));
-            batch->rawSetVertices(batchIndex, vertices);
-            std::free(vertices);
-            if(batch->shouldBuffer == false) {
-                batch->shouldBuffer = true;
+            out[0] = in[0];
+            out[1] = in[from == 1 ? 0 : 1];
+            out[2] = in[from == 1 ? 0 : 2];
+
+            if(to == 4) {
+                out[3] = from == 4 ? in[3] : 255;
             }
-            invisible = true;
         }
     }
 }
 
-void photon::Sprite::remove() {
-    if(isAdded()) {
-        batch->removeSprite(this);
-        batch = nullptr;
-        batchIndex = 0;
-    }
-}
+// Decodes into the requested channel count directly, avoiding a conversion pass
+template<u32 Channels>
+static bool decodeQoiPixels(const u8 *bytes, usize size, u8 *out, usize pixelCount) {
+    u8 index[64][4] = {};
+    u8 pixel[4] = {0, 0, 0, 255};
+    usize p = 14;
+    const usize end = size - 8;
+    u32 run = 0;
 
-photon::Font::Font(std::string path) {
-    std::ifstream fontFile(path.c_str(), std::ios::binary);
+    for(usize i = 0; i < pixelCount; i++, out += Channels) {
+        if(run > 0) {
+            run--;
+        } else if(p < end) {
+            u8 op = bytes[p++];
 
-    if(!fontFile.is_open()) {
-        std::cerr << "Failed to open TTF file " << path << std::endl;
-        std::exit(-1);
-    }
+            if(op == 0xfe) {
+                std::memcpy(pixel, &bytes[p], 3);
+                p += 3;
+            } else if(op == 0xff) {
+                std::memcpy(pixel, &bytes[p], 4);
+                p += 4;
+            } else if((op & 0xc0) == 0x00) {
+                std::memcpy(pixel, index[op], 4);
+            } else if((op & 0xc0) == 0x40) {
+                pixel[0] += ((op >> 4) & 3) - 2;
+                pixel[1] += ((op >> 2) & 3) - 2;
+                pixel[2] += (op & 3) - 2;
+            } else if((op & 0xc0) == 0x80) {
+                u8 next = bytes[p++];
+                i32 green = (op & 0x3f) - 32;
+                pixel[0] += green - 8 + (next >> 4);
+                pixel[1] += green;
+                pixel[2] += green - 8 + (next & 0x0f);
+            } else {
+                run = op & 0x3f;
+            }
 
-    i32 fileSize = 0;
-    fontFile.seekg(0, std::ios::end);
-    fileSize = (i32) fontFile.tellg();
-    fontFile.seekg(0, std::ios::beg);
-    u8 *data = new u8[fileSize];
-    fontFile.read((char*) data, fileSize);
-    fontFile.close();
+            std::memcpy(index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64], pixel, 4);
+        } else {
+            return false;
+        }
 
-    createFromTTF(data, fileSize);
+        if(Channels == 1) {
+            out[0] = luminance(pixel);
+        } else {
+            std::memcpy(out, pixel, Channels);
+        }
+    }
 
-    delete[] data;
+    return true;
 }
 
-void photon::Font::createFromTTF(const u8 *data, const usize dataSize) {
-    stbtt_InitFont(&info, data, 0);
+static photon::Image decodeQoi(const u8 *bytes, usize size, photon::Texture::TextureType type) {
+    photon::Image image;
 
-    size.x = 4096;
-    size.y = 4096;
-    maxHeight = 0;
-    packedCharsBufferSize = ('~' - ' ');
+    if(size < 22) {
+        return image;
+    }
 
-    const usize fontMonochromeBufferSize = size.x * size.y;
-	const usize fontRgbaBufferSize = size.x * size.y * 4;
+    u32 width = (u32) bytes[4] << 24 | (u32) bytes[5] << 16 | (u32) bytes[6] << 8 | bytes[7];
+    u32 height = (u32) bytes[8] << 24 | (u32) bytes[9] << 16 | (u32) bytes[10] << 8 | bytes[11];
+    usize pixelCount = (usize) width * height;
 
-    u8 *fontMonochromeBuffer = new u8[fontMonochromeBufferSize];
-    u8 *fontRgbaBuffer = new u8[fontRgbaBufferSize];
+    if(width == 0 || height == 0 || pixelCount > (usize) 1 << 30) {
+        return image;
+    }
 
-    packedCharsBuffer = new stbtt_packedchar[packedCharsBufferSize] {};
+    u32 channels = channelCount(type);
+    u8 *data = (u8*) std::malloc(pixelCount * channels);
+    bool decoded = channels == 4 ? decodeQoiPixels<4>(bytes, size, data, pixelCount)
+        : channels == 3 ? decodeQoiPixels<3>(bytes, size, data, pixelCount)
+        : decodeQoiPixels<1>(bytes, size, data, pixelCount);
 
-    stbtt_pack_context stbttContext;
-    stbtt_PackBegin(&stbttContext, fontMonochromeBuffer, size.x, size.y, 0, 2, nullptr);
-    stbtt_PackSetOversampling(&stbttContext, 2, 2);
-    stbtt_PackFontRange(&stbttContext, data, 0, 65, ' ', '~' - ' ', packedCharsBuffer);
-	stbtt_PackEnd(&stbttContext);
+    if(!decoded) {
+        std::free(data);
+        return image;
+    }
 
-    for(i32 i = 0; i < fontMonochromeBufferSize; i++) {
-        fontRgbaBuffer[(i * 4)] = fontMonochromeBuffer[i];
-		fontRgbaBuffer[(i * 4) + 1] = fontMonochromeBuffer[i];
-		fontRgbaBuffer[(i * 4) + 2] = fontMonochromeBuffer[i];
+    image.data = data;
+    image.width = width;
+    image.height = height;
+    image.type = type;
 
-		if (fontMonochromeBuffer[i] > 1) {
-			fontRgbaBuffer[(i * 4) + 3] = 255;
-		} else {
-			fontRgbaBuffer[(i * 4) + 3] = 0;
-		}
-    }
+    return image;
+}
 
-    texture.type = Texture::RGBA;
-    glGenTextures(1, &texture.handle);
-    glBindTexture(GL_TEXTURE_2D, texture.handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, fontRgbaBuffer);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// LZ4 block format: a token with literal and match lengths, the literals, then a 16-bit offset
+// for the match. The last sequence is literals only.
+static usize lz4Decompress(const u8 *src, usize srcSize, u8 *dst, usize dstSize) {
+    const u8 *ip = src;
+    const u8 *const inEnd = src + srcSize;
+    u8 *op = dst;
+    u8 *const outEnd = dst + dstSize;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    while(ip < inEnd) {
+        u8 token = *ip++;
+        usize literals = token >> 4;
 
-    delete[] fontMonochromeBuffer;
-    delete[] fontRgbaBuffer;
+        if(literals == 15) {
+            u8 extra;
 
-    for (char c = ' '; c <= '~'; c++) {
-        stbtt_aligned_quad quad = getGlyphQuad(c);
-        f32 height = quad.y1 - quad.y0;
+            do {
+                if(ip >= inEnd) {
+                    return SIZE_MAX;
+                }
 
-        if(height > maxHeight && height < 1.e+8f) {
-            maxHeight = height;
+                extra = *ip++;
+                literals += extra;
+            } while(extra == 255);
         }
-    }
-}
 
-stbtt_aligned_quad photon::Font::getGlyphQuad(const char c) {
-    stbtt_aligned_quad quad = {0};
+        if((usize) (inEnd - ip) < literals || (usize) (outEnd - op) < literals) {
+            return SIZE_MAX;
+        }
 
-	f32 x = 0;
-	f32 y = 0;
+        std::memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
 
-	stbtt_GetPackedQuad(packedCharsBuffer, size.x, size.y, c - ' ', &x, &y, &quad, 1);
-    return quad;
-}
+        if(ip == inEnd) {
+            break;
+        }
 
-glm::vec4 photon::Font::getGlyphTexCoords(const char c) {
-    f32 xOffset = 0.0f;
-    f32 yOffset = 0.0f;
+        if(inEnd - ip < 2) {
+            return SIZE_MAX;
+        }
 
-    stbtt_aligned_quad quad = getGlyphQuad(c);
+        usize offset = (usize) ip[0] | (usize) ip[1] << 8;
+        ip += 2;
 
-    return glm::vec4(quad.s0, quad.t0, quad.s1, quad.t1);
+        if(offset == 0 || offset > (usize) (op - dst)) {
+            return SIZE_MAX;
+        }
+
+        usize length = (token & 15) + 4;
+
+        if((token & 15) == 15) {
+            u8 extra;
+
+            do {
+                if(ip >= inEnd) {
+                    return SIZE_MAX;
+                }
+
+                extra = *ip++;
+                length += extra;
+            } while(extra == 255);
+        }
+
+        if((usize) (outEnd - op) < length) {
+            return SIZE_MAX;
+        }
+
+        const u8 *match = op - offset;
+
+        // Copying eight bytes at a time is safe when the match is at least that far back
+        if(offset >= 8 && (usize) (outEnd - op) >= length + 8) {
+            u8 *copyEnd = op + length;
+
+            while(op < copyEnd) {
+                std::memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            }
+
+            op = copyEnd;
+        } else {
+            for(usize i = 0; i < length; i++) {
+                op[i] = match[i];
+            }
+
+            op += length;
+        }
+    }
+
+    return (usize) (op - dst);
 }
 
-photon::Text::Text(Font *font, std::string str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, bool centered) : font(font), str(str), pos(pos), size(size), color(color), spacing(spacing), centered(centered) {
-    createSprites();
+static void writeLz4Length(std::vector<u8> &out, usize length) {
+    for(; length >= 255; length -= 255) {
+        out.push_back(255);
+    }
+
+    out.push_back((u8) length);
 }
 
-void photon::Text::createSprites() {
-    u32 length = str.size();
+static void writeLz4Sequence(std::vector<u8> &out, const u8 *literals, usize literalCount, usize offset, usize matchLength) {
+    usize matchCode = matchLength > 0 ? matchLength - 4 : 0;
+    out.push_back((u8) (std::min<usize>(literalCount, 15) << 4 | std::min<usize>(matchCode, 15)));
 
-    f32 xPos = pos.x;
-    f32 yPos = pos.y;
+    if(literalCount >= 15) {
+        writeLz4Length(out, literalCount - 15);
+    }
 
-    f32 scale = stbtt_ScaleForPixelHeight(&font->info, 64.0f);
+    out.insert(out.end(), literals, literals + literalCount);
 
-    i32 ascent, descent, lineGap;
-    stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+    if(matchLength > 0) {
+        out.push_back((u8) offset);
+        out.push_back((u8) (offset >> 8));
 
-    for(i32 i = 0; i < length; i++) {
-        char c = str[i];
-        stbtt_aligned_quad quad = font->getGlyphQuad(c);
+        if(matchCode >= 15) {
+            writeLz4Length(out, matchCode - 15);
+        }
+    }
+}
 
-        if(c == ' ') {
-            xPos += spacing * 5.0f;
-        } else if(c == '\n') {
-            yPos -= (ascent - descent + lineGap) * scale * size;
-            xPos = pos.x;
-        } else if (c >= ' ' && c <= '~') {
-            photon::Sprite sprite(glm::vec2(xPos, yPos - quad.y1 * size), glm::vec2((quad.x1 - quad.x0) * size, (quad.y1 - quad.y0) * size), &font->texture);
-            sprite.texCoords = font->getGlyphTexCoords(c);
-            sprite.color = color;
-            sprites.push_back(sprite);
-            xPos += (quad.x1 - quad.x0) * size + spacing;
+// Greedy single-probe matcher; the format requires the last 5 bytes to be literals and the last
+// match to start at least 12 bytes before the end
+static void lz4Compress(const u8 *src, usize size, std::vector<u8> &out) {
+    constexpr usize MIN_MATCH = 4;
+    constexpr usize LAST_LITERALS = 5;
+    constexpr usize MATCH_LIMIT = 12;
+    constexpr u32 HASH_BITS = 16;
+
+    std::vector<u32> table(1 << HASH_BITS, UINT32_MAX);
+    usize anchor = 0;
+    usize ip = 0;
+
+    while(size > MATCH_LIMIT && ip < size - MATCH_LIMIT) {
+        u32 sequence;
+        std::memcpy(&sequence, &src[ip], 4);
+        u32 hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        usize candidate = table[hash];
+        table[hash] = (u32) ip;
+
+        u32 found;
+
+        if(candidate == UINT32_MAX || ip - candidate > 65535 || (std::memcpy(&found, &src[candidate], 4), found != sequence)) {
+            // Skip faster through data that does not compress
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        usize length = MIN_MATCH;
+        const usize maxLength = size - LAST_LITERALS - ip;
+
+        while(length < maxLength && src[candidate + length] == src[ip + length]) {
+            length++;
         }
+
+        writeLz4Sequence(out, &src[anchor], ip - anchor, ip - candidate, length);
+
+        ip += length;
+        anchor = ip;
     }
+
+    writeLz4Sequence(out, &src[anchor], size - anchor, 0, 0);
 }
 
-void photon::Text::update() {
-    for(Sprite &sprite : sprites) {
-        sprite.remove();
+static photon::Image decodeLz4Container(const u8 *bytes, usize size, photon::Texture::TextureType type) {
+    photon::Image image;
+
+    if(size < 24) {
+        return image;
     }
 
-    sprites.clear();
+    u32 width = readU32(&bytes[4]);
+    u32 height = readU32(&bytes[8]);
+    u32 channels = readU32(&bytes[12]);
+    u32 chunkSize = readU32(&bytes[16]);
+    u32 chunkCount = readU32(&bytes[20]);
+    usize rawSize = (usize) width * height * channels;
 
-    createSprites();
-}
+    if(width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4) || chunkSize == 0
+        || rawSize > (usize) 1 << 32 || chunkCount != (rawSize + chunkSize - 1) / chunkSize || size < 24 + (usize) chunkCount * 4) {
+        return image;
+    }
 
-photon::SpriteBatch::SpriteBatch(Texture *texture, ShaderProgram *shader) : texture(texture), shader(shader) {
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    u32 wanted = channelCount(type);
+    u8 *raw = (u8*) std::malloc(rawSize);
+    const u8 *chunk = &bytes[24 + (usize) chunkCount * 4];
+    bool decoded = true;
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE_BYTES, nullptr, GL_DYNAMIC_DRAW);
+    for(u32 i = 0; i < chunkCount && decoded; i++) {
+        usize compressedSize = readU32(&bytes[24 + (usize) i * 4]);
+        usize offset = (usize) i * chunkSize;
+        usize expected = std::min<usize>(chunkSize, rawSize - offset);
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, Renderer2D::VERTEX_SIZE_BYTES, (void*) 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, Renderer2D::VERTEX_SIZE_BYTES, (void*) (2 * sizeof(f32)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, Renderer2D::VERTEX_SIZE_BYTES, (void*) (6 * sizeof(f32)));
-    glEnableVertexAttribArray(2);
+        decoded = (usize) (bytes + size - chunk) >= compressedSize
+            && lz4Decompress(chunk, compressedSize, &raw[offset], expected) == expected;
+        chunk += compressedSize;
+    }
+
+    if(!decoded) {
+        std::free(raw);
+        return image;
+    }
 
-    data = new f32[BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE];
+    if(wanted != channels) {
+        u8 *converted = (u8*) std::malloc((usize) width * height * wanted);
+        convertChannels(raw, channels, converted, wanted, (usize) width * height);
+        std::free(raw);
+        raw = converted;
+    }
+
+    image.data = raw;
+    image.width = width;
+    image.height = height;
+    image.type = type;
+
+    return image;
 }
 
-void photon::SpriteBatch::addSprite(Sprite *sprite) {
-    if(hasSpace()) {
-        sprite->batch = this;
-        sprite->batchIndex = spriteCount;
+photon::Image::Image(const std::string &path, Texture::TextureType type) {
+    MappedFile *file = MappedFile::acquire(path);
 
-        spriteCount++;
+    if(file) {
+        *this = decode(file->data, file->size, type);
+        MappedFile::release(file);
+    }
 
-        updateSprite(sprite);
+    if(!data) {
+        std::cerr << "Failed to load image " << path << std::endl;
+        std::exit(-1);
     }
 }
 
-void photon::SpriteBatch::updateSprite(Sprite *sprite) {
-    f32 vertices[] = {
-        sprite->pos.x, sprite->pos.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.x, sprite->texCoords.w,
-        sprite->pos.x + sprite->size.x, sprite->pos.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.z, sprite->texCoords.w,
-        sprite->pos.x + sprite->size.x, sprite->pos.y + sprite->size.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.z, sprite->texCoords.y,
-        sprite->pos.x + sprite->size.x, sprite->pos.y + sprite->size.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.z, sprite->texCoords.y,
-        sprite->pos.x, sprite->pos.y + sprite->size.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.x, sprite->texCoords.y,
-        sprite->pos.x, sprite->pos.y, sprite->color.r, sprite->color.g, sprite->color.b, sprite->color.a, sprite->texCoords.x, sprite->texCoords.w,
-    };
+photon::Image photon::Image::decode(const u8 *bytes, usize size, Texture::TextureType type) {
+    Image image;
+
+    if(size >= 4 && std::memcmp(bytes, "qoif", 4) == 0) {
+        image = decodeQoi(bytes, size, type);
+    } else if(size >= 4 && readU32(bytes) == LZ4_MAGIC) {
+        image = decodeLz4Container(bytes, size, type);
+    } else {
+        // stb_image allocates with malloc as well, so destroy() frees every image the same way
+        i32 width, height, channels;
+        image.data = stbi_load_from_memory(bytes, (i32) size, &width, &height, &channels, (i32) channelCount(type));
+
+        if(image.data) {
+            image.width = (u32) width;
+            image.height = (u32) height;
+            image.type = type;
+        }
+    }
+
+    if(image.data) {
+        image.opaque = isFullyOpaque(image.data, image.width, image.height, type);
+    }
 
-    rawSetVertices(sprite->batchIndex, vertices);
-    shouldBuffer = true;
+    return image;
 }
 
-void photon::SpriteBatch::removeSprite(Sprite *sprite) {
-    std::memcpy(&data[sprite->batchIndex * 6 * Renderer2D::VERTEX_SIZE], &data[(spriteCount - 1) * 6 * Renderer2D::VERTEX_SIZE], Renderer2D::VERTEX_SIZE * 6 * sizeof(f32));
-    std::memset(&data[(spriteCount - 1) * 6 * Renderer2D::VERTEX_SIZE], 0, 6 * Renderer2D::VERTEX_SIZE_BYTES);
-    sprite->batch = nullptr;
-    sprite->batchIndex = 0;
+std::vector<u8> photon::Image::encodeQoi(const u8 *pixels, u32 width, u32 height, u32 channels) {
+    std::vector<u8> out = {'q', 'o', 'i', 'f'};
 
-    spriteCount--;
-    shouldBuffer = true;
+    for(u32 value : {width, height}) {
+        for(i32 shift = 24; shift >= 0; shift -= 8) {
+            out.push_back((u8) (value >> shift));
+        }
+    }
+
+    out.push_back((u8) channels);
+    out.push_back(0);
+
+    u8 index[64][4] = {};
+    u8 previous[4] = {0, 0, 0, 255};
+    u8 pixel[4] = {0, 0, 0, 255};
+    u32 run = 0;
+    const usize pixelCount = (usize) width * height;
+
+    for(usize i = 0; i < pixelCount; i++) {
+        std::memcpy(pixel, &pixels[i * channels], channels);
+
+        if(std::memcmp(pixel, previous, 4) == 0) {
+            run++;
+
+            if(run == 62 || i == pixelCount - 1) {
+                out.push_back((u8) (0xc0 | (run - 1)));
+                run = 0;
+            }
+
+            continue;
+        }
+
+        if(run > 0) {
+            out.push_back((u8) (0xc0 | (run - 1)));
+            run = 0;
+        }
+
+        u32 hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+
+        if(std::memcmp(index[hash], pixel, 4) == 0) {
+            out.push_back((u8) hash);
+        } else {
+            std::memcpy(index[hash], pixel, 4);
+
+            if(pixel[3] == previous[3]) {
+                i8 dr = (i8) (pixel[0] - previous[0]);
+                i8 dg = (i8) (pixel[1] - previous[1]);
+                i8 db = (i8) (pixel[2] - previous[2]);
+                i8 drg = (i8) (dr - dg);
+                i8 dbg = (i8) (db - dg);
+
+                if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back((u8) (0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    out.push_back((u8) (0x80 | (dg + 32)));
+                    out.push_back((u8) ((drg + 8) << 4 | (dbg + 8)));
+                } else {
+                    out.insert(out.end(), {0xfe, pixel[0], pixel[1], pixel[2]});
+                }
+            } else {
+                out.insert(out.end(), {0xff, pixel[0], pixel[1], pixel[2], pixel[3]});
+            }
+        }
+
+        std::memcpy(previous, pixel, 4);
+    }
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+
+    return out;
 }
 
-bool photon::SpriteBatch::hasSpace() {
-    return spriteCount < BATCH_SIZE;
+std::vector<u8> photon::Image::encodeLz4(const u8 *pixels, u32 width, u32 height, u32 channels) {
+    const usize rawSize = (usize) width * height * channels;
+    const u32 chunkCount = (u32) ((rawSize + LZ4_CHUNK_SIZE - 1) / LZ4_CHUNK_SIZE);
+
+    std::vector<u8> out;
+    writeU32(out, LZ4_MAGIC);
+    writeU32(out, width);
+    writeU32(out, height);
+    writeU32(out, channels);
+    writeU32(out, LZ4_CHUNK_SIZE);
+    writeU32(out, chunkCount);
+    out.resize(out.size() + (usize) chunkCount * 4);
+
+    for(u32 i = 0; i < chunkCount; i++) {
+        usize offset = (usize) i * LZ4_CHUNK_SIZE;
+        usize start = out.size();
+        lz4Compress(&pixels[offset], std::min<usize>(LZ4_CHUNK_SIZE, rawSize - offset), out);
+
+        u32 compressedSize = (u32) (out.size() - start);
+
+        for(u32 byte = 0; byte < 4; byte++) {
+            out[24 + (usize) i * 4 + byte] = (u8) (compressedSize >> (byte * 8));
+        }
+    }
+
+    return out;
 }
 
-void photon::SpriteBatch::rawSetVertices(i32 index, f32 *vertices) {
-    std::memcpy(&data[(index * 6 * Renderer2D::VERTEX_SIZE)], vertices, 6 * Renderer2D::VERTEX_SIZE_BYTES);
+u32 photon::Image::channels() const {
+    return channelCount(type);
 }
 
-void photon::SpriteBatch::render(const Camera &camera) {
-    if(shouldBuffer) {
-        bufferData();
-        shouldBuffer = false;
+void photon::Image::destroy() {
+    std::free(data);
+    data = nullptr;
+}
+
+photon::RenderTarget::RenderTarget(u32 width, u32 height, Format format, bool withDepthStencil) : dimensions(width, height), format(format) {
+    texture.type = Texture::RGBA;
+    glGenTextures(1, &texture.handle);
+    texture.bind();
+
+    if(format == RGBA16F) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     }
 
-    shader->bind();
-    shader->setInt("uTexture", 0);
-    shader->setMat4("uProj", camera.proj);
-    shader->setMat4("uView", camera.view);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glBindVertexArray(vao);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.handle, 0);
 
-    texture->bind();
+    if(withDepthStencil) {
+        glGenRenderbuffers(1, &depthStencil);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+    }
 
-    glDrawArrays(GL_TRIANGLES, 0, spriteCount * 6);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Failed to create render target of size " << width << "x" << height << std::endl;
+        std::exit(-1);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void photon::SpriteBatch::destroy() {
-    delete[] data;
+void photon::RenderTarget::bind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 }
 
-void photon::SpriteBatch::bufferData() {
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE_BYTES, data);
+void photon::RenderTarget::destroy() {
+    if(fbo) {
+        glDeleteFramebuffers(1, &fbo);
+        texture.destroy();
+    }
+
+    if(depthStencil) {
+        glDeleteRenderbuffers(1, &depthStencil);
+    }
+
+    fbo = 0;
+    depthStencil = 0;
+    dimensions = glm::uvec2(0);
 }
 
-photon::Renderer2D::Renderer2D(const Window *window) : window(window) {
-    shader = ShaderProgram(std::string(vertexShaderSource), std::string(fragmentShaderSource));
+photon::RenderTarget *photon::RenderTargetPool::acquire(glm::uvec2 dimensions, RenderTarget::Format format) {
+    for(Entry &entry : entries) {
+        if(!entry.inUse && entry.target->dimensions == dimensions && entry.target->format == format) {
+            entry.inUse = true;
+            entry.idleFrames = 0;
+            return entry.target;
+        }
+    }
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    RenderTarget *target = new RenderTarget(dimensions.x, dimensions.y, format, false);
+    entries.push_back({target, true, 0});
 
-    glEnable(GL_MULTISAMPLE);
+    return target;
 }
 
-void photon::Renderer2D::setClearColor(f32 r, f32 g, f32 b, f32 a) {
-    glClearColor(r, g, b, a);
+void photon::RenderTargetPool::release(RenderTarget *target) {
+    for(Entry &entry : entries) {
+        if(entry.target == target) {
+            entry.inUse = false;
+            return;
+        }
+    }
 }
 
-void photon::Renderer2D::addSprite(Sprite *sprite) {
-    bool added = false;
+void photon::RenderTargetPool::collect(u32 maxIdleFrames) {
+    for(usize i = 0; i < entries.size();) {
+        Entry &entry = entries[i];
 
-    for(SpriteBatch *batch : batches) {
-        if(batch->texture == sprite->texture && batch->hasSpace()) {
-            batch->addSprite(sprite);
-            added = true;
-            break;
+        if(!entry.inUse && ++entry.idleFrames > maxIdleFrames) {
+            entry.target->destroy();
+            delete entry.target;
+            entries[i] = entries.back();
+            entries.pop_back();
+        } else {
+            i++;
         }
     }
+}
 
-    if(!added) {
-        SpriteBatch *batch = new SpriteBatch(sprite->texture, &shader);
-        batch->addSprite(sprite);
-        batches.push_back(batch);
+void photon::RenderTargetPool::destroy() {
+    for(Entry &entry : entries) {
+        entry.target->destroy();
+        delete entry.target;
     }
+
+    entries.clear();
 }
 
-void photon::Renderer2D::addText(Text *text) {
-    for(Sprite &sprite : text->sprites) {
-        addSprite(&sprite);
+photon::PostEffect::PostEffect(Type type, glm::vec4 params) : type(type), params(params) {
+
+}
+
+photon::PostEffect photon::PostEffect::colorGrading(f32 exposure, f32 contrast, f32 saturation) {
+    return PostEffect(COLOR_GRADING, glm::vec4(exposure, contrast, saturation, 0.0f));
+}
+
+photon::PostEffect photon::PostEffect::vignette(f32 intensity, f32 radius, f32 softness) {
+    return PostEffect(VIGNETTE, glm::vec4(intensity, radius, softness, 0.0f));
+}
+
+photon::PostEffect photon::PostEffect::bloom(f32 threshold, f32 intensity, f32 spread) {
+    return PostEffect(BLOOM, glm::vec4(threshold, intensity, spread, 0.0f));
+}
+
+photon::PostEffect photon::PostEffect::custom(std::string code, glm::vec4 params) {
+    PostEffect effect(CUSTOM, params);
+    effect.code = code;
+    return effect;
+}
+
+bool photon::PostEffect::isActive() const {
+    if(!enabled) {
+        return false;
+    }
+
+    switch(type) {
+    case COLOR_GRADING:
+        return params.x != 0.0f || params.y != 1.0f || params.z != 1.0f;
+    case VIGNETTE:
+        return params.x > 0.0f;
+    case BLOOM:
+        return params.y > 0.0f;
+    default:
+        return !code.empty();
     }
 }
 
-void photon::Renderer2D::updateText(Text *text) {
-    text->update();
-    addText(text);
+f32 photon::Tween::progress(f64 time, f32 *elapsed) const {
+    f32 seconds = (f32) std::max(time - start, 0.0);
+    f32 t = 0.0f;
+
+    if(duration > 0.0f) {
+        t = seconds / duration;
+
+        if(repeat == PING_PONG) {
+            t = 1.0f - std::abs(std::fmod(t, 2.0f) - 1.0f);
+        } else if(repeat == LOOP) {
+            t = t - std::floor(t);
+        } else {
+            t = std::min(t, 1.0f);
+            seconds = std::min(seconds, duration);
+        }
+    }
+
+    if(elapsed) {
+        *elapsed = seconds;
+    }
+
+    return easeTween(t, easing);
 }
 
-void photon::Renderer2D::render() {
-    glClear(GL_COLOR_BUFFER_BIT);
+f64 photon::Tween::end() const {
+    return repeat == ONCE && duration > 0.0f ? start + duration : INFINITY;
+}
 
-    f32 aspectRatio = window->aspectRatio();
+photon::Sprite::Sprite(glm::vec2 pos, glm::vec2 size, photon::Texture *texture) : pos(pos), size(size), texture(texture) {
 
-    if(aspectRatio >= 1.0f) {
-        camera.proj = glm::ortho(0.0f, 100.0f * aspectRatio, 0.0f, 100.0f, -1.0f, 1.0f);
-    } else {
-        camera.proj = glm::ortho(0.0f, 100.0f, 0.0f, 100.0f / aspectRatio, -1.0f, 1.0f);
+}
+
+bool photon::Sprite::isAdded() {
+    return batch != nullptr;
+}
+
+void photon::Sprite::update() {
+    if(isAdded()) {
+        Renderer2D *renderer = batch->renderer;
+
+        if(renderer && batch->key() != renderer->batchKey(this)) {
+            remove();
+            renderer->addSprite(this);
+        } else {
+            batch->markDirty(this);
+        }
     }
+}
 
-    camera.view =
-        glm::lookAt(
-		glm::vec3(0.0f, 0.0f, 0.0f),
-		glm::vec3(0.0f, 0.0f, 0.0f)
-		    + glm::vec3(0.0f, 0.0f, -1.0f),
-		glm::vec3(0.0f, 1.0f, 0.0f));
+void photon::Sprite::toggleInvisibility() {
+    if(isAdded()) {
+        if(invisible) {
+            update();
+            invisible = false;
+        } else {
+            batch->clearDirty(this);
+            batch->rawSetVertices(batchIndex, zeroVertices);
+            batch->markBuffer(batchIndex, batchIndex + 1);
+            invisible = true;
+        }
+    }
+}
 
-    for(SpriteBatch *batch : batches) {
-        batch->render(camera);
+void photon::Sprite::remove() {
+    if(isAdded()) {
+        batch->removeSprite(this);
+        batch = nullptr;
+        batchIndex = 0;
     }
 }
 
-void photon::Renderer2D::destroy() {
-    for(SpriteBatch *batch : batches) {
-        batch->destroy();
-        delete batch;
+static std::mutex mappedFilesMutex;
+static std::unordered_map<std::string, photon::MappedFile*> mappedFiles;
+
+photon::MappedFile *photon::MappedFile::acquire(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mappedFilesMutex);
+
+    auto it = mappedFiles.find(path);
+
+    if(it != mappedFiles.end()) {
+        it->second->refCount++;
+        return it->second;
+    }
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(fileHandle == INVALID_HANDLE_VALUE) {
+        return nullptr;
     }
-}
\ No newline at end of file
+
+    LARGE_INTEGER fileSize;
+
+    if(!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(fileHandle);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(fileHandle);
+
+    if(!mapping) {
+        return nullptr;
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if(!data) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    usize size = (usize) fileSize.QuadPart;
+#else
+    i32 fd = open(path.c_str(), O_RDONLY);
+
+    if(fd < 0) {
+        return nullptr;
+    }
+
+    struct stat fileStat;
+
+    if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    usize size = (usize) fileStat.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    void *mapping = nullptr;
+#endif
+
+    MappedFile *file = new MappedFile();
+    file->path = path;
+    file->data = (const u8*) data;
+    file->size = size;
+    file->refCount = 1;
+    file->mapping = mapping;
+
+    mappedFiles[path] = file;
+
+    return file;
+}
+
+void photon::MappedFile::release(MappedFile *file) {
+    if(!file) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mappedFilesMutex);
+
+    if(--file->refCount > 0) {
+        return;
+    }
+
+    mappedFiles.erase(file->path);
+
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE) file->mapping);
+#else
+    munmap((void*) file->data, file->size);
+#endif
+
+    delete file;
+}
+
+photon::Font::Font(std::string path) {
+    file = MappedFile::acquire(path);
+
+    if(!file) {
+        std::cerr << "Failed to open TTF file " << path << std::endl;
+        std::exit(-1);
+    }
+
+    createFromTTF(file->data, file->size);
+}
+
+void photon::Font::destroy() {
+    texture.destroy();
+
+    delete[] packedCharsBuffer;
+    packedCharsBuffer = nullptr;
+
+    delete[] bitmap;
+    bitmap = nullptr;
+
+    MappedFile::release(file);
+    file = nullptr;
+}
+
+void photon::Font::createFromTTF(const u8 *data, const usize dataSize) {
+    bake(data, dataSize);
+    upload();
+}
+
+void photon::Font::bake(const u8 *data, const usize dataSize) {
+    PHOTON_PROFILE_ZONE("Font::bake");
+
+    stbtt_InitFont(&info, data, 0);
+
+    size.x = 4096;
+    size.y = 4096;
+    maxHeight = 0;
+    packedCharsBufferSize = ('~' - ' ');
+
+    const usize fontMonochromeBufferSize = size.x * size.y;
+
+    bitmap = new u8[fontMonochromeBufferSize];
+
+    packedCharsBuffer = new stbtt_packedchar[packedCharsBufferSize] {};
+
+    stbtt_pack_context stbttContext;
+    stbtt_PackBegin(&stbttContext, bitmap, size.x, size.y, 0, 2, nullptr);
+    stbtt_PackSetOversampling(&stbttContext, 2, 2);
+    stbtt_PackFontRange(&stbttContext, data, 0, 65, ' ', '~' - ' ', packedCharsBuffer);
+	stbtt_PackEnd(&stbttContext);
+
+    for (char c = ' '; c <= '~'; c++) {
+        stbtt_aligned_quad quad = getGlyphQuad(c);
+        f32 height = quad.y1 - quad.y0;
+
+        if(height > maxHeight && height < 1.e+8f) {
+            maxHeight = height;
+        }
+    }
+}
+
+void photon::Font::upload() {
+    PHOTON_PROFILE_ZONE("Font::upload");
+
+    texture.type = Texture::RED;
+    glGenTextures(1, &texture.handle);
+    glBindTexture(GL_TEXTURE_2D, texture.handle);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size.x, size.y, 0, GL_RED, GL_UNSIGNED_BYTE, bitmap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    delete[] bitmap;
+    bitmap = nullptr;
+}
+
+stbtt_aligned_quad photon::Font::getGlyphQuad(const char c) {
+    stbtt_aligned_quad quad = {0};
+
+	f32 x = 0;
+	f32 y = 0;
+
+	stbtt_GetPackedQuad(packedCharsBuffer, size.x, size.y, c - ' ', &x, &y, &quad, 1);
+    return quad;
+}
+
+glm::vec4 photon::Font::getGlyphTexCoords(const char c) {
+    f32 xOffset = 0.0f;
+    f32 yOffset = 0.0f;
+
+    stbtt_aligned_quad quad = getGlyphQuad(c);
+
+    return glm::vec4(quad.s0, quad.t0, quad.s1, quad.t1);
+}
+
+bool photon::SpriteHandle::operator==(const SpriteHandle &other) const {
+    return index == other.index && generation == other.generation;
+}
+
+bool photon::SpriteHandle::operator!=(const SpriteHandle &other) const {
+    return !(*this == other);
+}
+
+photon::SpritePool::SpritePool(std::pmr::memory_resource *resource)
+    : resource(resource), chunks(resource), slots(resource), dense(resource), denseSlots(resource) {
+
+}
+
+photon::SpritePool::~SpritePool() {
+    clear();
+}
+
+photon::Sprite *photon::SpritePool::create(glm::vec2 pos, glm::vec2 size, Texture *texture) {
+    if(freeHead == SpriteHandle::INVALID) {
+        Sprite *chunk = (Sprite*) resource->allocate(CHUNK_SIZE * sizeof(Sprite), alignof(Sprite));
+        chunks.push_back(chunk);
+
+        // Chain the new slots so the lowest index is handed out first
+        u32 first = (u32) slots.size();
+
+        for(u32 i = 0; i < CHUNK_SIZE; i++) {
+            slots.push_back({0, 0, i + 1 < CHUNK_SIZE ? first + i + 1 : SpriteHandle::INVALID});
+        }
+
+        freeHead = first;
+    }
+
+    u32 index = freeHead;
+    Slot &slot = slots[index];
+    freeHead = slot.nextFree;
+
+    slot.denseIndex = (u32) dense.size();
+    slot.nextFree = SpriteHandle::INVALID;
+
+    Sprite *sprite = new (slotSprite(index)) Sprite(pos, size, texture);
+    sprite->handle = {index, slot.generation};
+
+    dense.push_back(sprite);
+    denseSlots.push_back(index);
+
+    return sprite;
+}
+
+void photon::SpritePool::destroy(Sprite *sprite) {
+    if(contains(sprite)) {
+        destroy(sprite->handle);
+    }
+}
+
+void photon::SpritePool::destroy(SpriteHandle handle) {
+    Sprite *sprite = get(handle);
+
+    if(!sprite) {
+        return;
+    }
+
+    sprite->remove();
+    sprite->~Sprite();
+
+    Slot &slot = slots[handle.index];
+    u32 last = denseSlots.back();
+    dense[slot.denseIndex] = dense.back();
+    denseSlots[slot.denseIndex] = last;
+    slots[last].denseIndex = slot.denseIndex;
+    dense.pop_back();
+    denseSlots.pop_back();
+
+    slot.generation++;
+    slot.nextFree = freeHead;
+    freeHead = handle.index;
+}
+
+photon::Sprite *photon::SpritePool::get(SpriteHandle handle) {
+    if(handle.index >= slots.size()) {
+        return nullptr;
+    }
+
+    const Slot &slot = slots[handle.index];
+
+    if(slot.generation != handle.generation || slot.nextFree != SpriteHandle::INVALID || dense.empty()
+        || denseSlots[slot.denseIndex] != handle.index) {
+        return nullptr;
+    }
+
+    return slotSprite(handle.index);
+}
+
+bool photon::SpritePool::contains(const Sprite *sprite) const {
+    // Only compares addresses, so sprites of a cleared pool can be passed without being read
+    std::less<const Sprite*> less;
+
+    for(usize chunk = 0; chunk < chunks.size(); chunk++) {
+        if(!less(sprite, chunks[chunk]) && less(sprite, chunks[chunk] + CHUNK_SIZE)) {
+            u32 index = (u32) (chunk * CHUNK_SIZE + (sprite - chunks[chunk]));
+            return slots[index].nextFree == SpriteHandle::INVALID && !dense.empty() && denseSlots[slots[index].denseIndex] == index;
+        }
+    }
+
+    return false;
+}
+
+usize photon::SpritePool::size() const {
+    return dense.size();
+}
+
+photon::Sprite **photon::SpritePool::begin() {
+    return dense.data();
+}
+
+photon::Sprite **photon::SpritePool::end() {
+    return dense.data() + dense.size();
+}
+
+void photon::SpritePool::clear() {
+    for(Sprite *sprite : dense) {
+        sprite->remove();
+        sprite->~Sprite();
+    }
+
+    for(Sprite *chunk : chunks) {
+        resource->deallocate(chunk, CHUNK_SIZE * sizeof(Sprite), alignof(Sprite));
+    }
+
+    chunks.clear();
+    slots.clear();
+    dense.clear();
+    denseSlots.clear();
+    freeHead = SpriteHandle::INVALID;
+}
+
+photon::Sprite *photon::SpritePool::slotSprite(u32 index) const {
+    return chunks[index / CHUNK_SIZE] + index % CHUNK_SIZE;
+}
+
+photon::Text::Text(Font *font, std::string str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, bool centered, SpritePool *pool, std::pmr::memory_resource *resource)
+    : font(font), pool(pool), str(str), sprites(resource), runs(resource), fonts(resource), pos(pos), size(size), color(color), spacing(spacing), centered(centered) {
+    createSprites();
+}
+
+void photon::Text::addRun(usize begin, usize length, glm::vec4 color, f32 scale, Font *font) {
+    Run run = {begin, begin + length, color, scale, font};
+
+    auto it = std::upper_bound(runs.begin(), runs.end(), begin, [](usize begin, const Run &run) {
+        return begin < run.begin;
+    });
+
+    runs.insert(it, run);
+}
+
+void photon::Text::clearRuns() {
+    runs.clear();
+}
+
+static bool parseHexColor(const std::string &value, glm::vec4 &color) {
+    if((value.size() != 7 && value.size() != 9) || value[0] != '#') {
+        return false;
+    }
+
+    for(usize i = 1; i < value.size(); i++) {
+        if(!std::isxdigit((unsigned char) value[i])) {
+            return false;
+        }
+    }
+
+    u32 hex = (u32) std::stoul(value.substr(1), nullptr, 16);
+
+    if(value.size() == 7) {
+        hex = (hex << 8) | 0xff;
+    }
+
+    color = glm::vec4((hex >> 24) & 0xff, (hex >> 16) & 0xff, (hex >> 8) & 0xff, hex & 0xff) / 255.0f;
+    return true;
+}
+
+void photon::Text::setMarkup(const std::string &markup) {
+    struct Style {
+        glm::vec4 color;
+        f32 scale;
+        Font *font;
+        bool styled;
+    };
+
+    std::vector<Style> stack = {{color, 1.0f, nullptr, false}};
+
+    str.clear();
+    str.reserve(markup.size());
+    runs.clear();
+
+    for(usize i = 0; i < markup.size(); i++) {
+        char c = markup[i];
+
+        if(c == '[' && i + 1 < markup.size() && markup[i + 1] == '[') {
+            i++;
+        } else if(c == '[') {
+            usize close = markup.find(']', i);
+
+            if(close != std::string::npos) {
+                std::string tag = markup.substr(i + 1, close - i - 1);
+                usize equals = tag.find('=');
+                std::string name = tag.substr(0, equals);
+                std::string value = equals == std::string::npos ? "" : tag.substr(equals + 1);
+
+                Style style = stack.back();
+                style.styled = true;
+                bool valid = true;
+
+                if(tag == "/color" || tag == "/scale" || tag == "/font") {
+                    if(stack.size() > 1) {
+                        stack.pop_back();
+                    }
+
+                    i = close;
+                    continue;
+                } else if(name == "color") {
+                    valid = parseHexColor(value, style.color);
+                } else if(name == "scale") {
+                    char *end = nullptr;
+                    style.scale = std::strtof(value.c_str(), &end);
+                    valid = end != value.c_str() && *end == '\0' && style.scale > 0.0f;
+                } else if(name == "font") {
+                    char *end = nullptr;
+                    usize index = std::strtoul(value.c_str(), &end, 10);
+                    valid = end != value.c_str() && *end == '\0' && index < fonts.size();
+
+                    if(valid) {
+                        style.font = fonts[index];
+                    }
+                } else {
+                    valid = false;
+                }
+
+                // Unknown or malformed tags are kept as text
+                if(valid) {
+                    stack.push_back(style);
+                    i = close;
+                    continue;
+                }
+            }
+        }
+
+        const Style &style = stack.back();
+
+        if(style.styled) {
+            Run *last = runs.empty() ? nullptr : &runs.back();
+
+            if(last && last->end == str.size() && last->color == style.color && last->scale == style.scale && last->font == style.font) {
+                last->end++;
+            } else {
+                runs.push_back({str.size(), str.size() + 1, style.color, style.scale, style.font});
+            }
+        }
+
+        str += c;
+    }
+}
+
+// Places a glyph sprite on the baseline and returns its width
+static f32 layoutGlyph(photon::Sprite *sprite, photon::Font *font, char c, f32 x, f32 baseline, f32 size, glm::vec4 color) {
+    stbtt_aligned_quad quad = font->getGlyphQuad(c);
+
+    sprite->pos = glm::vec2(x, baseline - quad.y1 * size);
+    sprite->size = glm::vec2((quad.x1 - quad.x0) * size, (quad.y1 - quad.y0) * size);
+    sprite->texture = &font->texture;
+    sprite->texCoords = glm::vec4(quad.s0, quad.t0, quad.s1, quad.t1);
+    sprite->color = color;
+    sprite->shaderFeatures = photon::ShaderVariant::GRAYSCALE;
+    sprite->update();
+
+    return (quad.x1 - quad.x0) * size;
+}
+
+void photon::Text::createSprites() {
+    if(!pool) {
+        return;
+    }
+
+    u32 length = str.size();
+    usize glyphCount = 0;
+
+    f32 xPos = pos.x;
+    f32 yPos = pos.y;
+
+    f32 scale = stbtt_ScaleForPixelHeight(&font->info, 64.0f);
+
+    i32 ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+
+    sprites.reserve(length);
+
+    usize runIndex = 0;
+
+    // Largest run scale among the glyphs of the line starting at begin, which sets the gap above it
+    auto lineScale = [this, length](usize begin, usize runIndex) {
+        f32 scale = 1.0f;
+
+        for(usize i = begin; i < length && str[i] != '\n'; i++) {
+            while(runIndex < runs.size() && runs[runIndex].end <= i) {
+                runIndex++;
+            }
+
+            if(str[i] > ' ' && str[i] <= '~' && runIndex < runs.size() && runs[runIndex].begin <= i) {
+                scale = std::max(scale, runs[runIndex].scale);
+            }
+        }
+
+        return scale;
+    };
+
+    for(i32 i = 0; i < length; i++) {
+        char c = str[i];
+
+        while(runIndex < runs.size() && runs[runIndex].end <= (usize) i) {
+            runIndex++;
+        }
+
+        Font *glyphFont = font;
+        glm::vec4 glyphColor = color;
+        f32 glyphScale = 1.0f;
+
+        if(runIndex < runs.size() && runs[runIndex].begin <= (usize) i) {
+            const Run &run = runs[runIndex];
+            glyphFont = run.font ? run.font : font;
+            glyphColor = run.color;
+            glyphScale = run.scale;
+        }
+
+        if(c == ' ') {
+            xPos += spacing * 5.0f * glyphScale;
+        } else if(c == '\n') {
+            yPos -= (ascent - descent + lineGap) * scale * size * lineScale(i + 1, runIndex);
+            xPos = pos.x;
+        } else if (c >= ' ' && c <= '~') {
+            if(glyphCount == sprites.size()) {
+                sprites.push_back(pool->create(glm::vec2(0.0f), glm::vec2(0.0f), &glyphFont->texture));
+                sprites.back()->glyph = true;
+            }
+
+            xPos += layoutGlyph(sprites[glyphCount++], glyphFont, c, xPos, yPos, size * glyphScale, glyphColor) + spacing * glyphScale;
+        }
+    }
+
+    while(sprites.size() > glyphCount) {
+        pool->destroy(sprites.back());
+        sprites.pop_back();
+    }
+}
+
+void photon::Text::update() {
+    createSprites();
+}
+
+void photon::Text::destroy() {
+    for(Sprite *sprite : sprites) {
+        pool->destroy(sprite);
+    }
+
+    sprites.clear();
+}
+
+photon::NumberText::NumberText(Font *font, glm::vec2 pos, f32 size, glm::vec4 color, u32 precision, u32 capacity, SpritePool *pool, std::pmr::memory_resource *resource)
+    : font(font), pool(pool), sprites(resource), shown(resource), pos(pos), size(size), color(color), precision(precision) {
+    for(u32 i = 0; i < GLYPH_COUNT; i++) {
+        quads[i] = font->getGlyphQuad(GLYPHS[i]);
+
+        if(GLYPHS[i] >= '0' && GLYPHS[i] <= '9') {
+            cellWidth = std::max(cellWidth, quads[i].x1 - quads[i].x0);
+        }
+    }
+
+    shown.resize(capacity, 0);
+    createSprites();
+}
+
+void photon::NumberText::set(i64 value) {
+    char buffer[32];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    show(buffer, result.ptr - buffer);
+}
+
+void photon::NumberText::set(f64 value) {
+    char buffer[64];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, (i32) precision);
+
+    // Fixed notation of huge values does not fit, fall back to the shortest form
+    if(result.ec != std::errc()) {
+        result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    }
+
+    show(buffer, result.ec == std::errc() ? result.ptr - buffer : 0);
+}
+
+void photon::NumberText::refresh() {
+    for(u32 i = 0; i < sprites.size(); i++) {
+        writeCell(i, shown[i]);
+    }
+}
+
+void photon::NumberText::createSprites() {
+    if(!pool || !sprites.empty()) {
+        return;
+    }
+
+    sprites.reserve(shown.size());
+
+    for(usize i = 0; i < shown.size(); i++) {
+        Sprite *sprite = pool->create(pos, glm::vec2(0.0f), &font->texture);
+        sprite->shaderFeatures = ShaderVariant::GRAYSCALE;
+        sprite->glyph = true;
+        sprites.push_back(sprite);
+    }
+
+    refresh();
+}
+
+void photon::NumberText::destroy() {
+    for(Sprite *sprite : sprites) {
+        pool->destroy(sprite);
+    }
+
+    sprites.clear();
+    shown.clear();
+}
+
+void photon::NumberText::show(const char *chars, usize length) {
+    for(u32 i = 0; i < shown.size(); i++) {
+        char c = i < length ? chars[i] : 0;
+
+        // Cells without sprites yet are written when createSprites() makes them
+        if(shown[i] != c) {
+            shown[i] = c;
+
+            if(i < sprites.size()) {
+                writeCell(i, c);
+            }
+        }
+    }
+}
+
+void photon::NumberText::writeCell(u32 cell, char c) {
+    Sprite *sprite = sprites[cell];
+    const char *glyph = c ? std::strchr(GLYPHS, c) : nullptr;
+
+    // Empty cells and characters without a glyph (inf, nan) collapse
+    if(!glyph) {
+        sprite->pos = pos;
+        sprite->size = glm::vec2(0.0f);
+        sprite->update();
+        return;
+    }
+
+    const stbtt_aligned_quad &quad = quads[glyph - GLYPHS];
+    f32 width = (quad.x1 - quad.x0) * size;
+
+    sprite->pos = glm::vec2(pos.x + cell * cellWidth * size + (cellWidth * size - width) * 0.5f, pos.y - quad.y1 * size);
+    sprite->size = glm::vec2(width, (quad.y1 - quad.y0) * size);
+    sprite->texCoords = glm::vec4(quad.s0, quad.t0, quad.s1, quad.t1);
+    sprite->color = color;
+    sprite->update();
+}
+
+photon::VirtualTexture::VirtualTexture(const std::string &path, u32 requestedSlots) : cacheSlots(std::clamp(requestedSlots, 2u, 256u)) {
+    file = MappedFile::acquire(path);
+
+    if(!file || file->size < sizeof(Header)) {
+        std::cerr << "Failed to open virtual texture " << path << std::endl;
+        std::exit(-1);
+    }
+
+    std::memcpy(&header, file->data, sizeof(Header));
+
+    if(header.magic != MAGIC || header.levels == 0 || header.levels > MAX_LEVELS || header.pageSize == 0) {
+        std::cerr << "Invalid virtual texture " << path << std::endl;
+        std::exit(-1);
+    }
+
+    // The cache is one texture, so at least two bordered pages have to fit along each side
+    i32 maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    if(header.pageSize > (u32) maxTextureSize / 2 - 2) {
+        std::cerr << "Virtual texture " << path << ": pages of " << header.pageSize << " texels exceed the maximum texture size of "
+            << maxTextureSize << std::endl;
+        std::exit(-1);
+    }
+
+    cacheSlots = std::min(cacheSlots, (u32) maxTextureSize / (header.pageSize + 2));
+
+    usize offset = sizeof(Header);
+
+    for(u32 level = 0; level < header.levels; level++) {
+        glm::uvec2 size = glm::max(glm::uvec2(header.width, header.height) >> level, glm::uvec2(1));
+        levelPages[level] = (size + header.pageSize - 1u) / header.pageSize;
+        levelRows[level] = indirectionHeight;
+        levelOffsets[level] = offset;
+
+        indirectionHeight += levelPages[level].y;
+        offset += (usize) levelPages[level].x * levelPages[level].y * pageBytes();
+    }
+
+    if(file->size < offset) {
+        std::cerr << "Truncated virtual texture " << path << std::endl;
+        std::exit(-1);
+    }
+
+    // The pinned coarsest level plus at least one streamed page
+    if((usize) levelPages[header.levels - 1].x * levelPages[header.levels - 1].y >= (usize) cacheSlots * cacheSlots) {
+        std::cerr << "Virtual texture " << path << ": the coarsest level does not fit in " << cacheSlots << "x" << cacheSlots
+            << " cache slots" << std::endl;
+        std::exit(-1);
+    }
+
+    u32 slotSize = header.pageSize + 2;
+
+    cache.type = Texture::RGBA;
+    cache.virtualTexture = this;
+    glGenTextures(1, &cache.handle);
+    glBindTexture(GL_TEXTURE_2D, cache.handle);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSlots * slotSize, cacheSlots * slotSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    indirection.type = Texture::RGBA;
+    glGenTextures(1, &indirection.handle);
+    glBindTexture(GL_TEXTURE_2D, indirection.handle);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, levelPages[0].x, indirectionHeight, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    slots.resize(cacheSlots * cacheSlots, {0, 0, false, false});
+    indirectionData.resize((usize) levelPages[0].x * indirectionHeight * 4, 0);
+
+    // The coarsest level is always resident so every page has something to fall back to
+    u32 coarsest = header.levels - 1;
+
+    for(u32 y = 0; y < levelPages[coarsest].y; y++) {
+        for(u32 x = 0; x < levelPages[coarsest].x; x++) {
+            u64 page = pageKey(coarsest, x, y);
+            upload(page, pageData(page), true);
+        }
+    }
+
+    rebuildIndirection();
+
+    worker = std::thread(&VirtualTexture::workerLoop, this);
+}
+
+bool photon::VirtualTexture::bake(const u8 *rgba, u32 width, u32 height, u32 pageSize, const std::string &path) {
+    std::ofstream out(path, std::ios::binary);
+
+    if(!out.is_open() || pageSize == 0) {
+        return false;
+    }
+
+    Header header = {MAGIC, width, height, pageSize, 1};
+
+    // Stop once the level fits in one page
+    while(header.levels < MAX_LEVELS && std::max(width >> (header.levels - 1), height >> (header.levels - 1)) > pageSize) {
+        header.levels++;
+    }
+
+    out.write((const char*) &header, sizeof(Header));
+
+    u32 slotSize = pageSize + 2;
+    std::vector<u8> level(rgba, rgba + (usize) width * height * 4);
+    std::vector<u8> page((usize) slotSize * slotSize * 4);
+    glm::uvec2 size(width, height);
+
+    for(u32 l = 0; l < header.levels; l++) {
+        if(l > 0) {
+            // 2x2 box filter, clamped at odd edges
+            glm::uvec2 next = glm::max(size / 2u, glm::uvec2(1));
+            std::vector<u8> reduced((usize) next.x * next.y * 4);
+
+            for(u32 y = 0; y < next.y; y++) {
+                for(u32 x = 0; x < next.x; x++) {
+                    for(u32 c = 0; c < 4; c++) {
+                        u32 x0 = std::min(x * 2, size.x - 1), x1 = std::min(x * 2 + 1, size.x - 1);
+                        u32 y0 = std::min(y * 2, size.y - 1), y1 = std::min(y * 2 + 1, size.y - 1);
+                        u32 sum = level[((usize) y0 * size.x + x0) * 4 + c] + level[((usize) y0 * size.x + x1) * 4 + c]
+                            + level[((usize) y1 * size.x + x0) * 4 + c] + level[((usize) y1 * size.x + x1) * 4 + c];
+                        reduced[((usize) y * next.x + x) * 4 + c] = (u8) ((sum + 2) / 4);
+                    }
+                }
+            }
+
+            level.swap(reduced);
+            size = next;
+        }
+
+        glm::uvec2 pages = (size + pageSize - 1u) / pageSize;
+
+        for(u32 py = 0; py < pages.y; py++) {
+            for(u32 px = 0; px < pages.x; px++) {
+                // Border texels come from the neighbouring pages, clamped at the image edge
+                for(u32 y = 0; y < slotSize; y++) {
+                    i64 sy = std::clamp((i64) py * pageSize + y - 1, (i64) 0, (i64) size.y - 1);
+
+                    for(u32 x = 0; x < slotSize; x++) {
+                        i64 sx = std::clamp((i64) px * pageSize + x - 1, (i64) 0, (i64) size.x - 1);
+                        std::memcpy(&page[((usize) y * slotSize + x) * 4], &level[((usize) sy * size.x + sx) * 4], 4);
+                    }
+                }
+
+                out.write((const char*) page.data(), page.size());
+            }
+        }
+    }
+
+    return out.good();
+}
+
+void photon::VirtualTexture::update(const Camera &camera, glm::uvec2 viewport, glm::vec2 pos, glm::vec2 size) {
+    frame++;
+
+    glm::mat4 inverseViewProj = glm::inverse(camera.proj * camera.view);
+    glm::vec2 viewMin = glm::vec2(inverseViewProj * glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f));
+    glm::vec2 viewMax = glm::vec2(inverseViewProj * glm::vec4(1.0f, 1.0f, 0.0f, 1.0f));
+
+    glm::vec2 visibleMin = glm::max(viewMin, pos);
+    glm::vec2 visibleMax = glm::min(viewMax, pos + size);
+
+    wanted.clear();
+
+    if(visibleMin.x < visibleMax.x && visibleMin.y < visibleMax.y && size.x > 0.0f && size.y > 0.0f) {
+        // Texture v runs from the top of the sprite down
+        glm::vec2 uvMin((visibleMin.x - pos.x) / size.x, 1.0f - (visibleMax.y - pos.y) / size.y);
+        glm::vec2 uvMax((visibleMax.x - pos.x) / size.x, 1.0f - (visibleMin.y - pos.y) / size.y);
+
+        f32 pixels = std::max(size.x / (viewMax.x - viewMin.x) * viewport.x, 1.0f);
+        f32 lod = std::log2(std::max((f32) header.width / pixels, 1.0f));
+        u32 level = std::min((u32) lod, header.levels - 1);
+
+        // Never ask for more pages than the cache can hold
+        for(; level < header.levels; level++) {
+            glm::uvec2 first = glm::uvec2(glm::clamp(uvMin, 0.0f, 0.99999f) * glm::vec2(levelPages[level]));
+            glm::uvec2 last = glm::uvec2(glm::clamp(uvMax, 0.0f, 0.99999f) * glm::vec2(levelPages[level]));
+            glm::uvec2 count = last - first + 1u;
+
+            if(count.x * count.y + levelPages[header.levels - 1].x * levelPages[header.levels - 1].y <= slots.size() || level == header.levels - 1) {
+                for(u32 y = first.y; y <= last.y; y++) {
+                    for(u32 x = first.x; x <= last.x; x++) {
+                        wanted.push_back(pageKey(level, x, y));
+                    }
+                }
+
+                break;
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.clear();
+
+        for(u64 page : wanted) {
+            auto it = resident.find(page);
+
+            if(it != resident.end()) {
+                slots[it->second].lastUsed = frame;
+            } else {
+                requests.push_back(page);
+            }
+        }
+    }
+
+    condition.notify_one();
+
+    ready.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        usize count = std::min<usize>(loaded.size(), uploadsPerFrame);
+        ready.assign(std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.begin() + count));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+
+    for(LoadedPage &page : ready) {
+        if(resident.find(page.page) == resident.end()) {
+            upload(page.page, page.data.data(), false);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for(LoadedPage &page : ready) {
+            freeBuffers.push_back(std::move(page.data));
+        }
+    }
+
+    // Coarser pages first, their subtrees already cover any finer page that changed under them
+    std::sort(changedPages.begin(), changedPages.end(), [](u64 a, u64 b) {
+        return (a >> 48) > (b >> 48);
+    });
+
+    for(u64 page : changedPages) {
+        updateIndirection(page);
+    }
+
+    changedPages.clear();
+}
+
+void photon::VirtualTexture::bind(ShaderProgram *program) {
+    Texture::activate(1);
+    indirection.bind();
+    Texture::activate(0);
+
+    i32 rows[MAX_LEVELS];
+
+    for(u32 i = 0; i < MAX_LEVELS; i++) {
+        rows[i] = (i32) levelRows[i];
+    }
+
+    program->setInt("uIndirection", 1);
+    program->setVec2("uVirtualSize", glm::vec2(header.width, header.height));
+    program->setFloat("uPageSize", (f32) header.pageSize);
+    program->setFloat("uCacheSlots", (f32) cacheSlots);
+    program->setInt("uLevelCount", (i32) header.levels);
+    glUniform1iv(glGetUniformLocation(program->handle, "uLevelRows"), MAX_LEVELS, rows);
+}
+
+u32 photon::VirtualTexture::residentPages() const {
+    return (u32) resident.size();
+}
+
+photon::VirtualTexture::~VirtualTexture() {
+    stopWorker();
+}
+
+void photon::VirtualTexture::destroy() {
+    stopWorker();
+
+    cache.destroy();
+    indirection.destroy();
+
+    MappedFile::release(file);
+    file = nullptr;
+}
+
+void photon::VirtualTexture::stopWorker() {
+    if(!worker.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_one();
+    worker.join();
+}
+
+u64 photon::VirtualTexture::pageKey(u32 level, u32 x, u32 y) {
+    return ((u64) level << 48) | ((u64) y << 24) | x;
+}
+
+usize photon::VirtualTexture::pageBytes() const {
+    return (usize) (header.pageSize + 2) * (header.pageSize + 2) * 4;
+}
+
+const u8 *photon::VirtualTexture::pageData(u64 page) const {
+    u32 level = (u32) (page >> 48);
+    u32 y = (u32) (page >> 24) & 0xffffff;
+    u32 x = (u32) page & 0xffffff;
+
+    return file->data + levelOffsets[level] + ((usize) y * levelPages[level].x + x) * pageBytes();
+}
+
+void photon::VirtualTexture::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true) {
+        condition.wait(lock, [this] {
+            return stopping || !requests.empty();
+        });
+
+        if(stopping) {
+            return;
+        }
+
+        u64 page = requests.front();
+        requests.pop_front();
+
+        std::vector<u8> data;
+
+        if(!freeBuffers.empty()) {
+            data = std::move(freeBuffers.back());
+            freeBuffers.pop_back();
+        }
+
+        lock.unlock();
+
+        // Copying out of the mapping is where the disk read happens, away from the render thread
+        data.resize(pageBytes());
+        std::memcpy(data.data(), pageData(page), data.size());
+
+        lock.lock();
+        loaded.push_back({page, std::move(data)});
+    }
+}
+
+bool photon::VirtualTexture::upload(u64 page, const u8 *data, bool pinned) {
+    u32 slot = UINT32_MAX;
+    u64 oldest = UINT64_MAX;
+
+    for(u32 i = 0; i < slots.size(); i++) {
+        if(!slots[i].used) {
+            slot = i;
+            break;
+        }
+
+        // Pages still wanted this frame stay
+        if(!slots[i].pinned && slots[i].lastUsed < frame && slots[i].lastUsed < oldest) {
+            slot = i;
+            oldest = slots[i].lastUsed;
+        }
+    }
+
+    if(slot == UINT32_MAX) {
+        return false;
+    }
+
+    if(slots[slot].used) {
+        resident.erase(slots[slot].page);
+        changedPages.push_back(slots[slot].page);
+    }
+
+    slots[slot] = {page, frame, true, pinned};
+    resident[page] = slot;
+    changedPages.push_back(page);
+
+    u32 slotSize = header.pageSize + 2;
+
+    glBindTexture(GL_TEXTURE_2D, cache.handle);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheSlots) * slotSize, (slot / cacheSlots) * slotSize, slotSize, slotSize, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+    return true;
+}
+
+void photon::VirtualTexture::writeIndirection(u32 level, u32 x, u32 y) {
+    u32 stride = levelPages[0].x;
+    u8 *entry = &indirectionData[((usize) (levelRows[level] + y) * stride + x) * 4];
+    auto it = resident.find(pageKey(level, x, y));
+
+    if(it != resident.end()) {
+        entry[0] = (u8) (it->second % cacheSlots);
+        entry[1] = (u8) (it->second / cacheSlots);
+        entry[2] = (u8) level;
+        entry[3] = 1;
+    } else if(level + 1 < header.levels) {
+        std::memcpy(entry, &indirectionData[((usize) (levelRows[level + 1] + y / 2) * stride + x / 2) * 4], 4);
+    }
+}
+
+void photon::VirtualTexture::rebuildIndirection() {
+    u32 stride = levelPages[0].x;
+
+    // Coarsest level first, so each page can inherit its parent's entry when it is not resident
+    for(i32 level = header.levels - 1; level >= 0; level--) {
+        for(u32 y = 0; y < levelPages[level].y; y++) {
+            for(u32 x = 0; x < levelPages[level].x; x++) {
+                writeIndirection(level, x, y);
+            }
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, indirection.handle);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stride, indirectionHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, indirectionData.data());
+
+    changedPages.clear();
+}
+
+void photon::VirtualTexture::updateIndirection(u64 page) {
+    u32 level = (u32) (page >> 48);
+    u32 y = (u32) (page >> 24) & 0xffffff;
+    u32 x = (u32) page & 0xffffff;
+    u32 stride = levelPages[0].x;
+
+    glBindTexture(GL_TEXTURE_2D, indirection.handle);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+
+    // Only the page and the finer pages under it can inherit its entry, a block that doubles per level
+    for(i32 finer = level; finer >= 0; finer--) {
+        u32 shift = level - finer;
+        glm::uvec2 first(x << shift, y << shift);
+        glm::uvec2 last = glm::min(first + (1u << shift) - 1u, levelPages[finer] - 1u);
+
+        if(first.x > last.x || first.y > last.y) {
+            break;
+        }
+
+        for(u32 row = first.y; row <= last.y; row++) {
+            for(u32 column = first.x; column <= last.x; column++) {
+                writeIndirection(finer, column, row);
+            }
+        }
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, first.x, levelRows[finer] + first.y, last.x - first.x + 1, last.y - first.y + 1, GL_RGBA_INTEGER,
+            GL_UNSIGNED_BYTE, &indirectionData[((usize) (levelRows[finer] + first.y) * stride + first.x) * 4]);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+photon::TextView::TextView(Font *font, const char *data, usize dataSize, glm::vec2 pos, glm::vec2 viewSize, f32 size, glm::vec4 color, f32 spacing, SpritePool *pool, std::pmr::memory_resource *resource)
+    : font(font), pool(pool), lineOffsets(resource), sprites(resource), pos(pos), viewSize(viewSize), size(size), color(color), spacing(spacing) {
+    setText(data, dataSize);
+    update();
+}
+
+photon::TextView::TextView(Font *font, std::string path, glm::vec2 pos, glm::vec2 viewSize, f32 size, glm::vec4 color, f32 spacing, SpritePool *pool, std::pmr::memory_resource *resource)
+    : font(font), pool(pool), lineOffsets(resource), sprites(resource), pos(pos), viewSize(viewSize), size(size), color(color), spacing(spacing) {
+    file = MappedFile::acquire(path);
+
+    if(!file) {
+        std::cerr << "Failed to open text file " << path << std::endl;
+        std::exit(-1);
+    }
+
+    setText((const char*) file->data, file->size);
+    update();
+}
+
+void photon::TextView::setText(const char *data, usize dataSize) {
+    this->data = data;
+    this->dataSize = dataSize;
+
+    lineOffsets.clear();
+    lineOffsets.push_back(0);
+
+    // Single forward pass, so mapped files are paged in sequentially
+    const char *begin = data;
+    const char *end = data + dataSize;
+
+    while(begin < end) {
+        const char *newline = (const char*) std::memchr(begin, '\n', end - begin);
+
+        if(!newline) {
+            break;
+        }
+
+        lineOffsets.push_back(newline - data + 1);
+        begin = newline + 1;
+    }
+
+    lineOffsets.push_back(dataSize + 1);
+}
+
+usize photon::TextView::lineCount() const {
+    return lineOffsets.size() - 1;
+}
+
+f32 photon::TextView::lineHeight() const {
+    f32 scale = stbtt_ScaleForPixelHeight(&font->info, 64.0f);
+
+    i32 ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+
+    return (ascent - descent + lineGap) * scale * size;
+}
+
+void photon::TextView::scrollTo(f32 line) {
+    f32 maxScroll = std::max(0.0f, (f32) lineCount() - viewSize.y / lineHeight());
+    scroll = std::clamp(line, 0.0f, maxScroll);
+}
+
+void photon::TextView::update() {
+    if(!pool) {
+        return;
+    }
+
+    f32 scale = stbtt_ScaleForPixelHeight(&font->info, 64.0f);
+
+    i32 ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+
+    f32 height = (ascent - descent + lineGap) * scale * size;
+    f32 top = pos.y - ascent * scale * size;
+    f32 right = pos.x + viewSize.x;
+
+    usize firstLine = (usize) std::max(0.0f, std::floor(scroll));
+    usize lastLine = std::min(lineCount(), (usize) std::max(0.0f, std::ceil(scroll + viewSize.y / height)));
+    usize glyphCount = 0;
+
+    for(usize line = firstLine; line < lastLine; line++) {
+        f32 xPos = pos.x;
+        f32 yPos = top - (line - scroll) * height;
+
+        usize begin = lineOffsets[line];
+        usize end = lineOffsets[line + 1] - 1;
+
+        for(usize i = begin; i < end && xPos < right; i++) {
+            char c = data[i];
+
+            if(c == ' ') {
+                xPos += spacing * 5.0f;
+            } else if(c == '\t') {
+                xPos += spacing * 20.0f;
+            } else if(c > ' ' && c <= '~') {
+                if(glyphCount == sprites.size()) {
+                    sprites.push_back(pool->create(glm::vec2(0.0f), glm::vec2(0.0f), &font->texture));
+                    sprites.back()->glyph = true;
+                }
+
+                xPos += layoutGlyph(sprites[glyphCount++], font, c, xPos, yPos, size, color) + spacing;
+            }
+        }
+    }
+
+    // Spare sprites are collapsed rather than released, so scrolling back to denser lines does not touch the batches
+    for(usize i = glyphCount; i < sprites.size(); i++) {
+        Sprite *sprite = sprites[i];
+
+        if(sprite->size != glm::vec2(0.0f)) {
+            sprite->pos = pos;
+            sprite->size = glm::vec2(0.0f);
+            sprite->update();
+        }
+    }
+}
+
+void photon::TextView::destroy() {
+    for(Sprite *sprite : sprites) {
+        pool->destroy(sprite);
+    }
+
+    sprites.clear();
+
+    MappedFile::release(file);
+    file = nullptr;
+}
+
+bool photon::SpriteBatch::Key::operator==(const Key &other) const {
+    return texture == other.texture && features == other.features && layer == other.layer && opaque == other.opaque
+        && mask == other.mask && maskShape == other.maskShape;
+}
+
+bool photon::SpriteBatch::Key::operator!=(const Key &other) const {
+    return !(*this == other);
+}
+
+photon::SpriteBatch::SpriteBatch(Renderer2D *renderer, const Key &key, ShaderProgram *shader)
+    : renderer(renderer), texture(key.texture), shader(shader), features(key.features), layer(key.layer), opaque(key.opaque), mask(key.mask), maskShape(key.maskShape), sprites(renderer->resource),
+    dirty((BATCH_SIZE + 63) / 64, 0, renderer->resource) {
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE_BYTES, nullptr, GL_DYNAMIC_DRAW);
+
+    setSpriteVertexAttributes();
+
+    data = (f32*) renderer->resource->allocate(BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE_BYTES, alignof(f32));
+}
+
+photon::SpriteBatch::Key photon::SpriteBatch::key() const {
+    return {texture, features, layer, opaque, mask, maskShape};
+}
+
+void photon::SpriteBatch::addSprite(Sprite *sprite) {
+    if(hasSpace()) {
+        sprite->batch = this;
+        sprite->batchIndex = spriteCount;
+        sprites.push_back(sprite);
+
+        spriteCount++;
+
+        markDirty(sprite);
+    }
+}
+
+void photon::SpriteBatch::updateSprite(Sprite *sprite) {
+    PHOTON_PROFILE_ZONE("SpriteBatch::updateSprite");
+
+    u32 tick = renderer ? renderer->currentTick() : 0;
+
+    // The first write of a tick starts from wherever the previous tick left the sprite
+    if(sprite->writtenTick != tick) {
+        sprite->prevPos = sprite->writtenTick == UINT32_MAX ? sprite->pos : sprite->writtenPos;
+        sprite->writtenTick = tick;
+    }
+
+    sprite->writtenPos = sprite->pos;
+
+    writeQuadVertices(&data[sprite->batchIndex * 6 * Renderer2D::VERTEX_SIZE], sprite->pos, sprite->prevPos, sprite->size, sprite->texCoords, sprite->color, sprite->clip, tick);
+    markBuffer(sprite->batchIndex, sprite->batchIndex + 1);
+
+    if(sprite->tween.active || tweenData) {
+        writeTween(sprite);
+    }
+
+    growBounds(sprite);
+}
+
+void photon::SpriteBatch::growBounds(Sprite *sprite) {
+    glm::vec4 spriteBounds(sprite->pos, sprite->pos + sprite->size);
+
+    // Several sprites can be added before the first flush, so the sprite count says nothing here
+    if(!boundsValid) {
+        bounds = spriteBounds;
+        boundsValid = true;
+    } else {
+        bounds = glm::vec4(glm::min(glm::vec2(bounds), glm::vec2(spriteBounds)), glm::max(glm::vec2(bounds.z, bounds.w), glm::vec2(spriteBounds.z, spriteBounds.w)));
+    }
+
+    f32 area = sprite->size.x * sprite->size.y;
+
+    if(sprite == largestSprite || area > largestArea) {
+        largestSprite = sprite;
+        largestArea = area;
+    }
+}
+
+void photon::SpriteBatch::removeSprite(Sprite *sprite) {
+    std::memcpy(&data[sprite->batchIndex * 6 * Renderer2D::VERTEX_SIZE], &data[(spriteCount - 1) * 6 * Renderer2D::VERTEX_SIZE], Renderer2D::VERTEX_SIZE * 6 * sizeof(f32));
+    std::memset(&data[(spriteCount - 1) * 6 * Renderer2D::VERTEX_SIZE], 0, 6 * Renderer2D::VERTEX_SIZE_BYTES);
+
+    if(tweenData) {
+        std::memcpy(&tweenData[sprite->batchIndex * 6 * Renderer2D::TWEEN_VERTEX_SIZE], &tweenData[(spriteCount - 1) * 6 * Renderer2D::TWEEN_VERTEX_SIZE], 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES);
+        std::memset(&tweenData[(spriteCount - 1) * 6 * Renderer2D::TWEEN_VERTEX_SIZE], 0, 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES);
+        shouldBufferTweens = true;
+    }
+
+    // The last slot moves into the removed one, and so does its dirty bit
+    u32 lastIndex = spriteCount - 1;
+    u64 lastBit = (dirty[lastIndex / 64] >> (lastIndex % 64)) & 1;
+    dirty[lastIndex / 64] &= ~(1ull << (lastIndex % 64));
+    clearDirty(sprite);
+    dirty[sprite->batchIndex / 64] |= (sprite->batchIndex != (i32) lastIndex ? lastBit : 0) << (sprite->batchIndex % 64);
+
+    Sprite *last = sprites.back();
+    last->batchIndex = sprite->batchIndex;
+    sprites[sprite->batchIndex] = last;
+    sprites.pop_back();
+
+    // The emptied last slot is past the drawn range and needs no upload
+    markBuffer(sprite->batchIndex, sprite->batchIndex + 1);
+
+    boundsDirty = true;
+
+    sprite->batch = nullptr;
+    sprite->batchIndex = 0;
+
+    spriteCount--;
+}
+
+void photon::SpriteBatch::markDirty(Sprite *sprite) {
+    dirty[sprite->batchIndex / 64] |= 1ull << (sprite->batchIndex % 64);
+    hasDirty = true;
+}
+
+void photon::SpriteBatch::clearDirty(Sprite *sprite) {
+    dirty[sprite->batchIndex / 64] &= ~(1ull << (sprite->batchIndex % 64));
+}
+
+static u32 countTrailingZeros(u64 value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (u32) __builtin_ctzll(value);
+#else
+    u32 count = 0;
+
+    while(!(value & 1)) {
+        value >>= 1;
+        count++;
+    }
+
+    return count;
+#endif
+}
+
+u32 photon::SpriteBatch::flushDirty() {
+    if(!hasDirty) {
+        return 0;
+    }
+
+    PHOTON_PROFILE_ZONE("SpriteBatch::flushDirty");
+
+    u32 rebuilt = 0;
+
+    for(u32 word = 0; word < (spriteCount + 63) / 64; word++) {
+        u64 bits = dirty[word];
+        dirty[word] = 0;
+
+        while(bits) {
+            Sprite *sprite = sprites[word * 64 + countTrailingZeros(bits)];
+            bits &= bits - 1;
+
+            // Invisible sprites get zeroed vertices until they are shown again
+            if(!sprite->invisible) {
+                updateSprite(sprite);
+                rebuilt++;
+            } else {
+                rawSetVertices(sprite->batchIndex, zeroVertices);
+                markBuffer(sprite->batchIndex, sprite->batchIndex + 1);
+            }
+        }
+    }
+
+    hasDirty = false;
+
+    return rebuilt;
+}
+
+// Unsigned key that orders like descending floats
+static u32 descendingKey(f32 value) {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    return ~bits;
+}
+
+u32 photon::SpriteBatch::sortByY() {
+    if(spriteCount < 2) {
+        return 0;
+    }
+
+    const usize blockSize = 6 * Renderer2D::VERTEX_SIZE;
+    const usize tweenBlockSize = 6 * Renderer2D::TWEEN_VERTEX_SIZE;
+    FrameArena &arena = renderer->frameArena;
+
+    u32 *keys = (u32*) arena.allocate(spriteCount * sizeof(u32), alignof(u32));
+    u32 descents = 0;
+
+    for(u32 i = 0; i < spriteCount; i++) {
+        keys[i] = descendingKey(sprites[i]->pos.y);
+        descents += i > 0 && keys[i - 1] > keys[i];
+    }
+
+    if(descents == 0) {
+        return 0;
+    }
+
+    // Insertion sort while the order is mostly intact, each move shifts one vertex block
+    u32 moves = 0;
+    const u32 moveBudget = spriteCount / 2 + 64;
+
+    if(descents <= spriteCount / 16 + 4) {
+        f32 block[blockSize];
+
+        for(u32 i = 1; i < spriteCount && moves <= moveBudget; i++) {
+            if(keys[i - 1] <= keys[i]) {
+                continue;
+            }
+
+            u32 key = keys[i];
+            Sprite *sprite = sprites[i];
+            u32 j = i;
+
+            while(j > 0 && keys[j - 1] > key) {
+                j--;
+            }
+
+            std::memcpy(block, &data[i * blockSize], sizeof(block));
+            std::memmove(&data[(j + 1) * blockSize], &data[j * blockSize], (i - j) * sizeof(block));
+            std::memcpy(&data[j * blockSize], block, sizeof(block));
+
+            if(tweenData) {
+                f32 tweenBlock[tweenBlockSize];
+                std::memcpy(tweenBlock, &tweenData[i * tweenBlockSize], sizeof(tweenBlock));
+                std::memmove(&tweenData[(j + 1) * tweenBlockSize], &tweenData[j * tweenBlockSize], (i - j) * sizeof(tweenBlock));
+                std::memcpy(&tweenData[j * tweenBlockSize], tweenBlock, sizeof(tweenBlock));
+            }
+
+            std::memmove(&keys[j + 1], &keys[j], (i - j) * sizeof(u32));
+            std::memmove(&sprites[j + 1], &sprites[j], (i - j) * sizeof(Sprite*));
+            keys[j] = key;
+            sprites[j] = sprite;
+
+            for(u32 k = j; k <= i; k++) {
+                sprites[k]->batchIndex = k;
+            }
+
+            markBuffer(j, i + 1);
+            moves += i - j + 1;
+        }
+
+        if(moves <= moveBudget) {
+            shouldBufferTweens = tweenData != nullptr;
+            return moves;
+        }
+    }
+
+    // LSD radix sort of (key, slot) pairs, then one gather of the sprites and their vertices
+    u32 *order = (u32*) arena.allocate(spriteCount * sizeof(u32), alignof(u32));
+    u32 *sortedKeys = (u32*) arena.allocate(spriteCount * sizeof(u32), alignof(u32));
+    u32 *sortedOrder = (u32*) arena.allocate(spriteCount * sizeof(u32), alignof(u32));
+
+    for(u32 i = 0; i < spriteCount; i++) {
+        order[i] = i;
+    }
+
+    for(u32 shift = 0; shift < 32; shift += 8) {
+        u32 counts[257] = {};
+
+        for(u32 i = 0; i < spriteCount; i++) {
+            counts[((keys[i] >> shift) & 0xff) + 1]++;
+        }
+
+        for(u32 i = 1; i < 257; i++) {
+            counts[i] += counts[i - 1];
+        }
+
+        for(u32 i = 0; i < spriteCount; i++) {
+            u32 bucket = (keys[i] >> shift) & 0xff;
+            sortedKeys[counts[bucket]] = keys[i];
+            sortedOrder[counts[bucket]++] = order[i];
+        }
+
+        std::swap(keys, sortedKeys);
+        std::swap(order, sortedOrder);
+    }
+
+    f32 *gathered = (f32*) arena.allocate(spriteCount * blockSize * sizeof(f32), alignof(f32));
+    Sprite **gatheredSprites = (Sprite**) arena.allocate(spriteCount * sizeof(Sprite*), alignof(Sprite*));
+
+    for(u32 i = 0; i < spriteCount; i++) {
+        std::memcpy(&gathered[i * blockSize], &data[order[i] * blockSize], blockSize * sizeof(f32));
+        gatheredSprites[i] = sprites[order[i]];
+        moves += order[i] != i;
+    }
+
+    std::memcpy(data, gathered, spriteCount * blockSize * sizeof(f32));
+
+    if(tweenData) {
+        f32 *gatheredTweens = (f32*) arena.allocate(spriteCount * tweenBlockSize * sizeof(f32), alignof(f32));
+
+        for(u32 i = 0; i < spriteCount; i++) {
+            std::memcpy(&gatheredTweens[i * tweenBlockSize], &tweenData[order[i] * tweenBlockSize], tweenBlockSize * sizeof(f32));
+        }
+
+        std::memcpy(tweenData, gatheredTweens, spriteCount * tweenBlockSize * sizeof(f32));
+        shouldBufferTweens = true;
+    }
+
+    for(u32 i = 0; i < spriteCount; i++) {
+        sprites[i] = gatheredSprites[i];
+        sprites[i]->batchIndex = i;
+    }
+
+    markBuffer(0, spriteCount);
+
+    return moves;
+}
+
+void photon::SpriteBatch::finishTweens(f64 time) {
+    if(!tweenData || time < nextTweenEnd) {
+        return;
+    }
+
+    // Baking can move a sprite to another batch, so collect the finished ones first
+    Sprite **finished = (Sprite**) renderer->frameArena.allocate(spriteCount * sizeof(Sprite*), alignof(Sprite*));
+    u32 count = 0;
+    nextTweenEnd = INFINITY;
+
+    for(Sprite *sprite : sprites) {
+        if(!sprite->tween.active) {
+            continue;
+        }
+
+        f64 end = sprite->tween.end();
+
+        if(end <= time) {
+            finished[count++] = sprite;
+        } else {
+            nextTweenEnd = std::min(nextTweenEnd, end);
+        }
+    }
+
+    for(u32 i = 0; i < count; i++) {
+        renderer->stopTween(finished[i]);
+    }
+}
+
+void photon::SpriteBatch::writeTween(Sprite *sprite) {
+    f32 block[6 * Renderer2D::TWEEN_VERTEX_SIZE] = {};
+
+    if(sprite->tween.active) {
+        writeTweenVertices(block, sprite->tween, (f32) sprite->tween.start, sprite->size);
+        nextTweenEnd = std::min(nextTweenEnd, sprite->tween.end());
+    }
+
+    if(!tweenData) {
+        enableTweens();
+    }
+
+    // Moving a tweened sprite or updating one without a tween leaves its block as it was
+    f32 *slot = &tweenData[sprite->batchIndex * 6 * Renderer2D::TWEEN_VERTEX_SIZE];
+
+    if(std::memcmp(slot, block, sizeof(block)) != 0) {
+        std::memcpy(slot, block, sizeof(block));
+        shouldBufferTweens = true;
+    }
+}
+
+void photon::SpriteBatch::enableTweens() {
+    if(tweenData) {
+        return;
+    }
+
+    tweenData = (f32*) renderer->resource->allocate(BATCH_SIZE * 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES, alignof(f32));
+    std::memset(tweenData, 0, BATCH_SIZE * 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES);
+
+    glBindVertexArray(vao);
+    glGenBuffers(1, &tweenVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, tweenVbo);
+    glBufferData(GL_ARRAY_BUFFER, BATCH_SIZE * 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES, nullptr, GL_DYNAMIC_DRAW);
+    setTweenVertexAttributes();
+
+    shader = renderer->getShader(features | ShaderVariant::TWEEN);
+}
+
+bool photon::SpriteBatch::hasSpace() {
+    return spriteCount < BATCH_SIZE;
+}
+
+void photon::SpriteBatch::rawSetVertices(i32 index, const f32 *vertices) {
+    std::memcpy(&data[(index * 6 * Renderer2D::VERTEX_SIZE)], vertices, 6 * Renderer2D::VERTEX_SIZE_BYTES);
+}
+
+void photon::SpriteBatch::markBuffer(u32 begin, u32 end) {
+    bufferBegin = std::min(bufferBegin, begin);
+    bufferEnd = std::max(bufferEnd, end);
+}
+
+void photon::SpriteBatch::recomputeBounds() {
+    bounds = glm::vec4(0.0f);
+    boundsValid = !sprites.empty();
+    largestSprite = nullptr;
+    largestArea = 0.0f;
+
+    for(usize i = 0; i < sprites.size(); i++) {
+        Sprite *sprite = sprites[i];
+        glm::vec4 spriteBounds(sprite->pos, sprite->pos + sprite->size);
+
+        if(i == 0) {
+            bounds = spriteBounds;
+        } else {
+            bounds = glm::vec4(glm::min(glm::vec2(bounds), glm::vec2(spriteBounds)), glm::max(glm::vec2(bounds.z, bounds.w), glm::vec2(spriteBounds.z, spriteBounds.w)));
+        }
+
+        if(sprite->size.x * sprite->size.y > largestArea) {
+            largestSprite = sprite;
+            largestArea = sprite->size.x * sprite->size.y;
+        }
+    }
+
+    boundsDirty = false;
+}
+
+void photon::SpriteBatch::render(const Camera &camera) {
+    if(bufferBegin < bufferEnd) {
+        bufferData();
+    }
+
+    if(shouldBufferTweens) {
+        glBindBuffer(GL_ARRAY_BUFFER, tweenVbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, spriteCount * 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES, tweenData);
+        shouldBufferTweens = false;
+    }
+
+    shader->bind();
+    shader->setMat4("uProj", camera.proj);
+    shader->setMat4("uView", camera.view);
+    shader->setFloat("uDepth", depth);
+    shader->setFloat("uTick", tickStamp(renderer->currentTick()));
+    shader->setFloat("uAlpha", glm::clamp(renderer->tickAlpha, 0.0f, 1.0f));
+
+    if(tweenData) {
+        shader->setFloat("uTime", renderer->frameStart);
+    }
+    renderer->bindClipRects(shader, features);
+
+    if(features & ShaderVariant::PREMULTIPLIED) {
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    glBindVertexArray(vao);
+
+    if(texture) {
+        if(features & ShaderVariant::VIRTUAL) {
+            texture->virtualTexture->bind(shader);
+        }
+
+        shader->setInt("uTexture", 0);
+        texture->bind();
+    }
+
+    glDrawArrays(GL_TRIANGLES, 0, spriteCount * 6);
+}
+
+void photon::SpriteBatch::destroy() {
+    renderer->resource->deallocate(data, BATCH_SIZE * 6 * Renderer2D::VERTEX_SIZE_BYTES, alignof(f32));
+    data = nullptr;
+
+    if(tweenData) {
+        renderer->resource->deallocate(tweenData, BATCH_SIZE * 6 * Renderer2D::TWEEN_VERTEX_SIZE_BYTES, alignof(f32));
+        tweenData = nullptr;
+    }
+}
+
+void photon::SpriteBatch::bufferData() {
+    // Slots past spriteCount are never drawn, so whatever the buffer holds there can stay
+    u32 end = std::min(bufferEnd, spriteCount);
+
+    if(bufferBegin < end) {
+        usize offset = (usize) bufferBegin * 6 * Renderer2D::VERTEX_SIZE;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(f32), (usize) (end - bufferBegin) * 6 * Renderer2D::VERTEX_SIZE_BYTES, &data[offset]);
+    }
+
+    bufferBegin = UINT32_MAX;
+    bufferEnd = 0;
+}
+
+void photon::DynamicResolution::update(f32 sceneTime) {
+    scale = glm::clamp(scale, minScale, maxScale);
+
+    if(sceneTime <= 0.0f) {
+        return;
+    }
+
+    averageTime = averageTime == 0.0f ? sceneTime : averageTime * 0.9f + sceneTime * 0.1f;
+
+    if(cooldown > 0) {
+        cooldown--;
+        return;
+    }
+
+    if(averageTime <= frameBudget && averageTime >= frameBudget * 0.7f) {
+        return;
+    }
+
+    // Fill cost grows with the pixel count, so aim for the square root of the time ratio
+    f32 desired = scale * std::sqrt(frameBudget * 0.9f / averageTime);
+    desired = glm::clamp(std::min(desired, scale + 0.05f), minScale, maxScale);
+
+    if(desired != scale) {
+        scale = desired;
+        averageTime = 0.0f;
+        cooldown = 15;
+    }
+}
+
+photon::Renderer2D::Renderer2D(const Window *window, std::pmr::memory_resource *resource)
+    : window(window), resource(resource), spritePool(resource), batches(resource), drawOrder(resource), occluders(resource), ySortedLayers(resource),
+    immediateRuns(resource) {
+    epoch = glfwGetTime();
+
+    shader = ShaderProgram(buildShaderSource(vertexShaderSource, 0), buildShaderSource(fragmentShaderSource, 0));
+    variants[0] = &shader;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDepthFunc(GL_LEQUAL);
+
+    glGenVertexArrays(1, &fullscreenVao);
+
+    glGenVertexArrays(1, &immediateVao);
+    glBindVertexArray(immediateVao);
+
+    glGenBuffers(1, &immediateVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, immediateVbo);
+
+    setSpriteVertexAttributes();
+
+    glEnable(GL_MULTISAMPLE);
+}
+
+void photon::Renderer2D::setClearColor(f32 r, f32 g, f32 b, f32 a) {
+    glClearColor(r, g, b, a);
+}
+
+photon::ShaderProgram *photon::Renderer2D::getShader(u32 features) {
+    if(!ShaderVariant::isValid(features)) {
+        std::cerr << "Invalid shader variant " << features << std::endl;
+        std::exit(-1);
+    }
+
+    if(!variants[features]) {
+        variants[features] = new ShaderProgram(buildShaderSource(vertexShaderSource, features), buildShaderSource(fragmentShaderSource, features));
+    }
+
+    return variants[features];
+}
+
+u32 photon::Renderer2D::spriteFeatures(const Sprite *sprite) const {
+    u32 features = sprite->shaderFeatures & ~(ShaderVariant::CLIP | ShaderVariant::TWEEN);
+
+    if(sprite->clip) {
+        features |= ShaderVariant::CLIP;
+    }
+
+    if(sprite->texture && sprite->texture->virtualTexture) {
+        features = (features | ShaderVariant::VIRTUAL) & ~(ShaderVariant::GRAYSCALE | ShaderVariant::SDF);
+    }
+
+    // Transparent texels of a mask shape must not write the stencil
+    if(sprite->mask && sprite->maskShape) {
+        features |= ShaderVariant::ALPHA_TEST;
+    }
+
+    if(!sprite->texture) {
+        return (features | ShaderVariant::UNTEXTURED) & ~(ShaderVariant::GRAYSCALE | ShaderVariant::SDF);
+    }
+
+    return features & ~ShaderVariant::UNTEXTURED;
+}
+
+bool photon::Renderer2D::isOpaque(const Sprite *sprite, u32 features) const {
+    // Masked sprites and mask shapes draw in the translucent pass, which sets up the stencil, whatever their opacity says
+    if(sprite->mask) {
+        return false;
+    }
+
+    // Tweens may fade or move a sprite off what it was hiding, even one marked opaque
+    if(sprite->tween.active) {
+        return false;
+    }
+
+    if(sprite->opacity != Sprite::OPACITY_AUTO) {
+        return sprite->opacity == Sprite::OPACITY_OPAQUE;
+    }
+
+    // Clipped sprites never cover their whole quad, so they cannot hide what is below them
+    if(sprite->color.a < 1.0f || (features & (ShaderVariant::GRAYSCALE | ShaderVariant::SDF | ShaderVariant::ALPHA_TEST | ShaderVariant::CLIP))) {
+        return false;
+    }
+
+    return !sprite->texture || sprite->texture->opaque;
+}
+
+photon::SpriteBatch::Key photon::Renderer2D::batchKey(const Sprite *sprite) const {
+    u32 features = spriteFeatures(sprite);
+    u32 mask = sprite->mask < MAX_MASKS ? sprite->mask : 0;
+    return {sprite->texture, features, sprite->layer, isOpaque(sprite, features), mask, mask != 0 && sprite->maskShape};
+}
+
+void photon::Renderer2D::addSprite(Sprite *sprite) {
+    bool added = false;
+    SpriteBatch::Key key = batchKey(sprite);
+
+    for(SpriteBatch *batch : batches) {
+        if(batch->key() == key && batch->hasSpace()) {
+            batch->addSprite(sprite);
+            added = true;
+            break;
+        }
+    }
+
+    if(!added) {
+        SpriteBatch *batch = new SpriteBatch(this, key, getShader(key.features));
+        batch->ySorted = isLayerYSorted(key.layer);
+        batch->addSprite(sprite);
+        batches.push_back(batch);
+        drawOrderDirty = true;
+    }
+}
+
+void photon::Renderer2D::addSprite(Sprite *sprite, const f32 *vertices) {
+    addSprite(sprite);
+
+    SpriteBatch *batch = sprite->batch;
+
+    if(!batch) {
+        return;
+    }
+
+    batch->clearDirty(sprite);
+    batch->rawSetVertices(sprite->batchIndex, vertices);
+    batch->growBounds(sprite);
+    batch->markBuffer(sprite->batchIndex, sprite->batchIndex + 1);
+
+    sprite->prevPos = sprite->pos;
+    sprite->writtenPos = sprite->pos;
+    sprite->writtenTick = tick;
+}
+
+photon::Sprite *photon::Renderer2D::createSprite(glm::vec2 pos, glm::vec2 size, Texture *texture) {
+    Sprite *sprite = spritePool.create(pos, size, texture);
+    addSprite(sprite);
+    return sprite;
+}
+
+void photon::Renderer2D::destroySprite(Sprite *sprite) {
+    spritePool.destroy(sprite);
+}
+
+static constexpr u32 SNAPSHOT_MAGIC = 0x53533250;
+static constexpr u32 SNAPSHOT_VERSION = 3;
+
+struct SnapshotHeader {
+    u32 magic;
+    u32 version;
+    u32 vertexSize;
+    u32 tweenVertexSize;
+    u32 spriteSize;
+    u32 slotCount;
+    u32 freeHead;
+    u32 liveCount;
+    u32 batchCount;
+};
+
+// Tween as fixed-width fields, so no padding or bool reaches the file
+struct SnapshotTween {
+    glm::vec2 offsetFrom;
+    glm::vec2 offsetTo;
+    glm::vec2 velocity;
+    f32 scaleFrom;
+    f32 scaleTo;
+    glm::vec4 colorFrom;
+    glm::vec4 colorTo;
+    // Relative to the time of saving for active tweens
+    f64 start;
+    f32 duration;
+    u32 easing;
+    u32 repeat;
+    u32 active;
+};
+
+// Everything a Sprite holds except pointers, which are rebuilt on load.
+// Records are zeroed before they are filled, the padding before tween is written too.
+struct SnapshotSprite {
+    u32 texture;
+    u32 invisible;
+    glm::vec2 pos;
+    glm::vec4 color;
+    glm::vec2 size;
+    glm::vec4 texCoords;
+    u32 shaderFeatures;
+    f32 layer;
+    u32 opacity;
+    u32 clip;
+    u32 mask;
+    u32 maskShape;
+    glm::vec2 prevPos;
+    glm::vec2 writtenPos;
+    u32 writtenTick;
+    SnapshotTween tween;
+};
+
+struct SnapshotBatch {
+    u32 texture;
+    u32 features;
+    f32 layer;
+    u32 opaque;
+    u32 mask;
+    u32 maskShape;
+    u32 spriteCount;
+    u32 hasTweens;
+};
+
+static const u32 NO_TEXTURE = UINT32_MAX;
+
+template<typename T>
+static void writeSnapshot(std::vector<u8> &out, const T *values, usize count = 1) {
+    const u8 *bytes = (const u8*) values;
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+// Bounds-checked reads from the mapped file, which gives no alignment guarantees
+struct SnapshotReader {
+    const u8 *cursor;
+    const u8 *end;
+
+    template<typename T>
+    bool read(T *values, usize count = 1) {
+        if(!skip<T>(count)) {
+            return false;
+        }
+
+        std::memcpy(values, cursor - count * sizeof(T), count * sizeof(T));
+        return true;
+    }
+
+    template<typename T>
+    bool skip(usize count) {
+        if((usize) (end - cursor) / sizeof(T) < count) {
+            return false;
+        }
+
+        cursor += count * sizeof(T);
+        return true;
+    }
+};
+
+static u32 textureId(const std::vector<photon::Texture*> &textures, photon::Texture *texture) {
+    if(!texture) {
+        return NO_TEXTURE;
+    }
+
+    auto it = std::find(textures.begin(), textures.end(), texture);
+    return it == textures.end() ? NO_TEXTURE - 1 : (u32) (it - textures.begin());
+}
+
+// Text objects keep raw pointers to their glyphs, which a load would free and reuse
+static bool holdsGlyphs(photon::SpritePool &pool, const std::string &path) {
+    for(photon::Sprite *sprite : pool) {
+        if(sprite->glyph) {
+            std::cerr << "Snapshot " << path << ": destroy text objects using the renderer's pool first" << std::endl;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool photon::Renderer2D::saveSnapshot(const std::string &path, const std::vector<Texture*> &textures) {
+    if(holdsGlyphs(spritePool, path)) {
+        return false;
+    }
+
+    flushDirtySprites();
+
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, (u32) VERTEX_SIZE, (u32) TWEEN_VERTEX_SIZE, (u32) sizeof(SnapshotSprite),
+        (u32) spritePool.slots.size(), spritePool.freeHead, (u32) spritePool.dense.size(), 0};
+
+    for(SpriteBatch *batch : batches) {
+        header.batchCount += batch->spriteCount > 0;
+    }
+
+    std::vector<u8> out;
+    writeSnapshot(out, &header);
+    writeSnapshot(out, spritePool.slots.data(), spritePool.slots.size());
+    writeSnapshot(out, spritePool.denseSlots.data(), spritePool.denseSlots.size());
+
+    for(Sprite *sprite : spritePool) {
+        SnapshotSprite record;
+        std::memset(&record, 0, sizeof(record));
+        record.texture = textureId(textures, sprite->texture);
+        record.invisible = sprite->invisible;
+        record.pos = sprite->pos;
+        record.color = sprite->color;
+        record.size = sprite->size;
+        record.texCoords = sprite->texCoords;
+        record.shaderFeatures = sprite->shaderFeatures;
+        record.layer = sprite->layer;
+        record.opacity = (u32) sprite->opacity;
+        record.clip = sprite->clip;
+        record.mask = sprite->mask;
+        record.maskShape = sprite->maskShape;
+        record.prevPos = sprite->prevPos;
+        record.writtenPos = sprite->writtenPos;
+        record.writtenTick = sprite->writtenTick;
+
+        const Tween &tween = sprite->tween;
+        record.tween.offsetFrom = tween.offsetFrom;
+        record.tween.offsetTo = tween.offsetTo;
+        record.tween.velocity = tween.velocity;
+        record.tween.scaleFrom = tween.scaleFrom;
+        record.tween.scaleTo = tween.scaleTo;
+        record.tween.colorFrom = tween.colorFrom;
+        record.tween.colorTo = tween.colorTo;
+        record.tween.start = tween.active ? tween.start - time() : tween.start;
+        record.tween.duration = tween.duration;
+        record.tween.easing = tween.easing;
+        record.tween.repeat = tween.repeat;
+        record.tween.active = tween.active;
+
+        if(record.texture == NO_TEXTURE - 1) {
+            std::cerr << "Snapshot " << path << ": a sprite uses a texture missing from the texture list" << std::endl;
+            return false;
+        }
+
+        writeSnapshot(out, &record);
+    }
+
+    for(SpriteBatch *batch : batches) {
+        if(batch->spriteCount == 0) {
+            continue;
+        }
+
+        SnapshotBatch record = {textureId(textures, batch->texture), batch->features, batch->layer, batch->opaque, batch->mask, batch->maskShape,
+            batch->spriteCount, batch->tweenData != nullptr};
+        writeSnapshot(out, &record);
+
+        for(Sprite *sprite : batch->sprites) {
+            if(!spritePool.contains(sprite)) {
+                std::cerr << "Snapshot " << path << ": only sprites made with createSprite can be saved" << std::endl;
+                return false;
+            }
+
+            writeSnapshot(out, &sprite->handle.index);
+        }
+
+        writeSnapshot(out, batch->data, batch->spriteCount * 6 * VERTEX_SIZE);
+
+        if(batch->tweenData) {
+            // Rewritten with the rebased starts on load
+            writeSnapshot(out, batch->tweenData, batch->spriteCount * 6 * TWEEN_VERTEX_SIZE);
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*) out.data(), out.size());
+
+    if(!file) {
+        std::cerr << "Failed to write snapshot " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool photon::Renderer2D::loadSnapshot(const std::string &path, const std::vector<Texture*> &textures) {
+    if(holdsGlyphs(spritePool, path)) {
+        return false;
+    }
+
+    MappedFile *file = MappedFile::acquire(path);
+
+    if(!file) {
+        std::cerr << "Failed to open snapshot " << path << std::endl;
+        return false;
+    }
+
+    // Validate the whole file before the current scene is touched
+    SnapshotReader reader = {file->data, file->data + file->size};
+    SnapshotHeader header;
+    bool valid = reader.read(&header) && header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION
+        && header.vertexSize == VERTEX_SIZE && header.tweenVertexSize == TWEEN_VERTEX_SIZE && header.spriteSize == sizeof(SnapshotSprite)
+        && header.slotCount % SpritePool::CHUNK_SIZE == 0 && header.liveCount <= header.slotCount;
+
+    const u8 *slotData = reader.cursor;
+    valid = valid && reader.skip<SpritePool::Slot>(header.slotCount);
+    const u8 *denseData = reader.cursor;
+    valid = valid && reader.skip<u32>(header.liveCount);
+    const u8 *spriteData = reader.cursor;
+    valid = valid && reader.skip<SnapshotSprite>(header.liveCount);
+
+    // 0 for free slots, 1 for live ones and 2 once a batch claimed the sprite
+    std::pmr::vector<u8> batched(valid ? header.slotCount : 0, 0, resource);
+
+    valid = valid && (header.freeHead < header.slotCount || header.freeHead == SpriteHandle::INVALID);
+
+    for(u32 i = 0; valid && i < header.liveCount; i++) {
+        u32 slot;
+        SpritePool::Slot slotRecord;
+        SnapshotSprite record;
+        std::memcpy(&slot, denseData + i * sizeof(u32), sizeof(u32));
+        std::memcpy(&record, spriteData + i * sizeof(SnapshotSprite), sizeof(SnapshotSprite));
+
+        valid = slot < header.slotCount && batched[slot] == 0 && (record.texture == NO_TEXTURE || record.texture < textures.size())
+            && record.opacity <= Sprite::OPACITY_TRANSLUCENT && record.tween.active <= 1
+            && record.tween.easing <= Tween::EASE_IN_OUT && record.tween.repeat <= Tween::PING_PONG;
+
+        if(valid) {
+            std::memcpy(&slotRecord, slotData + slot * sizeof(SpritePool::Slot), sizeof(SpritePool::Slot));
+            valid = slotRecord.denseIndex == i && slotRecord.nextFree == SpriteHandle::INVALID;
+            batched[slot] = 1;
+        }
+    }
+
+    // The free list has to visit every free slot exactly once, anything else loops or hands out a live slot
+    u32 freeCount = 0;
+
+    for(u32 slot = header.freeHead; valid && slot != SpriteHandle::INVALID; freeCount++) {
+        valid = slot < header.slotCount && batched[slot] == 0;
+
+        if(valid) {
+            SpritePool::Slot slotRecord;
+            std::memcpy(&slotRecord, slotData + slot * sizeof(SpritePool::Slot), sizeof(SpritePool::Slot));
+            batched[slot] = 3;
+            slot = slotRecord.nextFree;
+        }
+    }
+
+    valid = valid && freeCount == header.slotCount - header.liveCount;
+
+    std::pmr::vector<const u8*> batchRecords(resource);
+
+    for(u32 i = 0; valid && i < header.batchCount; i++) {
+        SnapshotBatch record;
+        batchRecords.push_back(reader.cursor);
+        valid = reader.read(&record) && record.spriteCount > 0 && record.spriteCount <= SpriteBatch::BATCH_SIZE
+            && (record.texture == NO_TEXTURE || record.texture < textures.size()) && ShaderVariant::isValid(record.features);
+
+        for(u32 j = 0; valid && j < record.spriteCount; j++) {
+            u32 slot;
+            valid = reader.read(&slot) && slot < header.slotCount && batched[slot] == 1;
+
+            if(valid) {
+                batched[slot] = 2;
+            }
+        }
+
+        valid = valid && reader.skip<f32>((usize) record.spriteCount * 6 * VERTEX_SIZE)
+            && (!record.hasTweens || reader.skip<f32>((usize) record.spriteCount * 6 * TWEEN_VERTEX_SIZE));
+    }
+
+    if(!valid || reader.cursor != reader.end) {
+        std::cerr << "Invalid snapshot " << path << std::endl;
+        MappedFile::release(file);
+        return false;
+    }
+
+    // Sprites outside the pool keep living, just no longer in a batch
+    for(SpriteBatch *batch : batches) {
+        for(Sprite *sprite : batch->sprites) {
+            sprite->batch = nullptr;
+            sprite->batchIndex = 0;
+        }
+
+        batch->destroy();
+        delete batch;
+    }
+
+    batches.clear();
+    drawOrder.clear();
+    drawOrderDirty = true;
+
+    spritePool.clear();
+
+    for(u32 i = 0; i < header.slotCount / SpritePool::CHUNK_SIZE; i++) {
+        spritePool.chunks.push_back((Sprite*) spritePool.resource->allocate(SpritePool::CHUNK_SIZE * sizeof(Sprite), alignof(Sprite)));
+    }
+
+    spritePool.slots.resize(header.slotCount);
+    std::memcpy(spritePool.slots.data(), slotData, header.slotCount * sizeof(SpritePool::Slot));
+    spritePool.denseSlots.resize(header.liveCount);
+    std::memcpy(spritePool.denseSlots.data(), denseData, header.liveCount * sizeof(u32));
+    spritePool.freeHead = header.freeHead;
+
+    for(u32 i = 0; i < header.liveCount; i++) {
+        SnapshotSprite record;
+        std::memcpy(&record, spriteData + i * sizeof(SnapshotSprite), sizeof(SnapshotSprite));
+
+        u32 slot = spritePool.denseSlots[i];
+        Sprite *sprite = new (spritePool.slotSprite(slot)) Sprite(record.pos, record.size, record.texture == NO_TEXTURE ? nullptr : textures[record.texture]);
+        sprite->handle = {slot, spritePool.slots[slot].generation};
+        sprite->invisible = record.invisible;
+        sprite->color = record.color;
+        sprite->texCoords = record.texCoords;
+        sprite->shaderFeatures = record.shaderFeatures;
+        sprite->layer = record.layer;
+        sprite->opacity = (Sprite::Opacity) record.opacity;
+        sprite->clip = record.clip;
+        sprite->mask = record.mask;
+        sprite->maskShape = record.maskShape;
+        sprite->prevPos = record.prevPos;
+        sprite->writtenPos = record.writtenPos;
+        sprite->writtenTick = record.writtenTick;
+
+        Tween &tween = sprite->tween;
+        tween.offsetFrom = record.tween.offsetFrom;
+        tween.offsetTo = record.tween.offsetTo;
+        tween.velocity = record.tween.velocity;
+        tween.scaleFrom = record.tween.scaleFrom;
+        tween.scaleTo = record.tween.scaleTo;
+        tween.colorFrom = record.tween.colorFrom;
+        tween.colorTo = record.tween.colorTo;
+        tween.active = record.tween.active != 0;
+        tween.start = tween.active ? record.tween.start + time() : record.tween.start;
+        tween.duration = record.tween.duration;
+        tween.easing = (Tween::Easing) record.tween.easing;
+        tween.repeat = (Tween::Repeat) record.tween.repeat;
+
+        spritePool.dense.push_back(sprite);
+    }
+
+    for(u32 i = 0; i < header.batchCount; i++) {
+        // Every read below was bounds-checked above
+        SnapshotBatch record;
+        std::memcpy(&record, batchRecords[i], sizeof(SnapshotBatch));
+        const u8 *cursor = batchRecords[i] + sizeof(SnapshotBatch);
+
+        SpriteBatch::Key key = {record.texture == NO_TEXTURE ? nullptr : textures[record.texture], record.features, record.layer, record.opaque != 0,
+            record.mask, record.maskShape != 0};
+        SpriteBatch *batch = new SpriteBatch(this, key, getShader(key.features));
+        batch->ySorted = isLayerYSorted(key.layer);
+
+        for(u32 j = 0; j < record.spriteCount; j++) {
+            u32 slot;
+            std::memcpy(&slot, cursor + j * sizeof(u32), sizeof(u32));
+
+            Sprite *sprite = spritePool.slotSprite(slot);
+            sprite->batch = batch;
+            sprite->batchIndex = (i32) j;
+            batch->sprites.push_back(sprite);
+
+            if(sprite->tween.active) {
+                batch->nextTweenEnd = std::min(batch->nextTweenEnd, sprite->tween.end());
+            }
+        }
+
+        batch->spriteCount = record.spriteCount;
+        batch->boundsDirty = true;
+
+        // Straight from the mapping into the vertex buffer, the copy in data is only read by later updates
+        usize vertexCount = (usize) record.spriteCount * 6;
+        cursor += record.spriteCount * sizeof(u32);
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount * VERTEX_SIZE_BYTES, cursor);
+        std::memcpy(batch->data, cursor, vertexCount * VERTEX_SIZE_BYTES);
+        cursor += vertexCount * VERTEX_SIZE_BYTES;
+
+        if(record.hasTweens) {
+            batch->enableTweens();
+            std::memcpy(batch->tweenData, cursor, vertexCount * TWEEN_VERTEX_SIZE_BYTES);
+
+            // The blocks hold the saving renderer's start times, every vertex starts with the start
+            for(u32 j = 0; j < record.spriteCount; j++) {
+                Sprite *sprite = batch->sprites[j];
+
+                for(u32 v = 0; sprite->tween.active && v < 6; v++) {
+                    batch->tweenData[(j * 6 + v) * TWEEN_VERTEX_SIZE] = (f32) sprite->tween.start;
+                }
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, batch->tweenVbo);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount * TWEEN_VERTEX_SIZE_BYTES, batch->tweenData);
+        }
+
+        batches.push_back(batch);
+    }
+
+    MappedFile::release(file);
+
+    return true;
+}
+
+void photon::Renderer2D::addOccluder(glm::vec4 rect, f32 layer) {
+    occluders.push_back({glm::vec4(rect.x, rect.y, rect.x + rect.z, rect.y + rect.w), layer});
+}
+
+u32 photon::Renderer2D::createClipRect(glm::vec4 rect) {
+    if(~clipSlots == 0) {
+        std::cerr << "Out of clip rects, at most " << MAX_CLIP_RECTS - 1 << " can exist" << std::endl;
+        std::exit(-1);
+    }
+
+    u32 index = 0;
+
+    while(clipSlots & (1ull << index)) {
+        index++;
+    }
+
+    clipSlots |= 1ull << index;
+    clipRectCount = std::max(clipRectCount, index + 1);
+
+    setClipRect(index, rect);
+
+    return index;
+}
+
+void photon::Renderer2D::setClipRect(u32 index, glm::vec4 rect) {
+    if(index > 0 && index < MAX_CLIP_RECTS) {
+        clipRects[index] = glm::vec4(rect.x, rect.y, rect.x + rect.z, rect.y + rect.w);
+    }
+}
+
+void photon::Renderer2D::destroyClipRect(u32 index) {
+    if(index > 0 && index < MAX_CLIP_RECTS) {
+        clipSlots &= ~(1ull << index);
+    }
+}
+
+void photon::Renderer2D::setLayerYSort(f32 layer, bool enabled) {
+    auto it = std::find(ySortedLayers.begin(), ySortedLayers.end(), layer);
+
+    if(enabled && it == ySortedLayers.end()) {
+        ySortedLayers.push_back(layer);
+    } else if(!enabled && it != ySortedLayers.end()) {
+        ySortedLayers.erase(it);
+    }
+
+    for(SpriteBatch *batch : batches) {
+        if(batch->layer == layer) {
+            batch->ySorted = enabled;
+        }
+    }
+}
+
+void photon::Renderer2D::advanceTick() {
+    tick++;
+}
+
+u32 photon::Renderer2D::currentTick() const {
+    return tick;
+}
+
+void photon::Renderer2D::startTween(Sprite *sprite, const Tween &tween) {
+    sprite->tween = tween;
+    sprite->tween.active = true;
+
+    if(sprite->tween.start < 0.0) {
+        sprite->tween.start = time();
+    }
+
+    sprite->update();
+}
+
+void photon::Renderer2D::stopTween(Sprite *sprite) {
+    if(!sprite->tween.active) {
+        return;
+    }
+
+    Tween &tween = sprite->tween;
+    f32 elapsed;
+    f32 t = tween.progress(time(), &elapsed);
+
+    f32 scale = glm::mix(tween.scaleFrom, tween.scaleTo, t);
+    glm::vec2 size = sprite->size * scale;
+
+    sprite->pos += glm::mix(tween.offsetFrom, tween.offsetTo, t) + tween.velocity * elapsed + (sprite->size - size) * 0.5f;
+    sprite->size = size;
+    sprite->color *= glm::mix(tween.colorFrom, tween.colorTo, t);
+    tween.active = false;
+
+    sprite->update();
+}
+
+f64 photon::Renderer2D::time() const {
+    return glfwGetTime() - epoch;
+}
+
+bool photon::Renderer2D::isLayerYSorted(f32 layer) const {
+    return std::find(ySortedLayers.begin(), ySortedLayers.end(), layer) != ySortedLayers.end();
+}
+
+void photon::Renderer2D::setDrawClip(u32 index) {
+    drawClip = index < MAX_CLIP_RECTS ? index : 0;
+}
+
+u32 photon::Renderer2D::createMask() {
+    if(maskSlots.all()) {
+        std::cerr << "Out of masks, at most " << MAX_MASKS - 1 << " can exist" << std::endl;
+        std::exit(-1);
+    }
+
+    u32 mask = 1;
+
+    while(maskSlots[mask]) {
+        mask++;
+    }
+
+    maskSlots[mask] = true;
+
+    return mask;
+}
+
+void photon::Renderer2D::destroyMask(u32 mask) {
+    if(mask > 0 && mask < MAX_MASKS) {
+        maskSlots[mask] = false;
+    }
+}
+
+void photon::Renderer2D::setStencilState(u32 mask, bool shape) {
+    if(mask == stencilMask && shape == stencilShape) {
+        return;
+    }
+
+    if(mask == 0) {
+        glDisable(GL_STENCIL_TEST);
+    } else {
+        glEnable(GL_STENCIL_TEST);
+
+        if(shape) {
+            // Shapes write their mask even where they are hidden, the masked content does its own depth test
+            glStencilFunc(GL_ALWAYS, mask, 0xff);
+            glStencilOp(GL_KEEP, GL_REPLACE, GL_REPLACE);
+        } else {
+            glStencilFunc(GL_EQUAL, mask, 0xff);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        }
+    }
+
+    if(shape != stencilShape) {
+        GLboolean write = shape ? GL_FALSE : GL_TRUE;
+        glColorMask(write, write, write, write);
+    }
+
+    stencilMask = mask;
+    stencilShape = shape;
+}
+
+void photon::Renderer2D::bindClipRects(ShaderProgram *program, u32 features) {
+    if(features & ShaderVariant::CLIP) {
+        program->setVec4Array("uClipRects", clipRects.data(), clipRectCount);
+    }
+}
+
+void photon::Renderer2D::addText(Text *text) {
+    if(!text->pool) {
+        text->pool = &spritePool;
+        text->createSprites();
+    }
+
+    for(Sprite *sprite : text->sprites) {
+        if(!sprite->isAdded()) {
+            addSprite(sprite);
+        }
+    }
+}
+
+void photon::Renderer2D::updateText(Text *text) {
+    text->update();
+    addText(text);
+}
+
+void photon::Renderer2D::addNumberText(NumberText *number) {
+    if(!number->pool) {
+        number->pool = &spritePool;
+        number->createSprites();
+    }
+
+    for(Sprite *sprite : number->sprites) {
+        if(!sprite->isAdded()) {
+            addSprite(sprite);
+        }
+    }
+}
+
+void photon::Renderer2D::addTextView(TextView *view) {
+    if(!view->pool) {
+        view->pool = &spritePool;
+        view->update();
+    }
+
+    for(Sprite *sprite : view->sprites) {
+        if(!sprite->isAdded()) {
+            addSprite(sprite);
+        }
+    }
+}
+
+void photon::Renderer2D::updateTextView(TextView *view) {
+    view->update();
+    addTextView(view);
+}
+
+void photon::Renderer2D::drawQuad(glm::vec2 pos, glm::vec2 size, glm::vec4 color, f32 layer) {
+    pushImmediateQuad(nullptr, ShaderVariant::UNTEXTURED, layer, pos, size, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), color);
+}
+
+void photon::Renderer2D::drawTexture(Texture *texture, glm::vec2 pos, glm::vec2 size, glm::vec4 texCoords, glm::vec4 color, f32 layer) {
+    pushImmediateQuad(texture, texture ? 0u : (u32) ShaderVariant::UNTEXTURED, layer, pos, size, texCoords, color);
+}
+
+void photon::Renderer2D::drawText(Font *font, std::string_view str, glm::vec2 pos, f32 size, glm::vec4 color, f32 spacing, f32 layer) {
+    f32 xPos = pos.x;
+    f32 yPos = pos.y;
+
+    f32 scale = stbtt_ScaleForPixelHeight(&font->info, 64.0f);
+
+    i32 ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&font->info, &ascent, &descent, &lineGap);
+
+    for(char c : str) {
+        if(c == ' ') {
+            xPos += spacing * 5.0f;
+        } else if(c == '\n') {
+            yPos -= (ascent - descent + lineGap) * scale * size;
+            xPos = pos.x;
+        } else if(c > ' ' && c <= '~') {
+            stbtt_aligned_quad quad = font->getGlyphQuad(c);
+            glm::vec2 glyphSize((quad.x1 - quad.x0) * size, (quad.y1 - quad.y0) * size);
+
+            pushImmediateQuad(&font->texture, ShaderVariant::GRAYSCALE, layer, glm::vec2(xPos, yPos - quad.y1 * size), glyphSize,
+                glm::vec4(quad.s0, quad.t0, quad.s1, quad.t1), color);
+
+            xPos += glyphSize.x + spacing;
+        }
+    }
+}
+
+void photon::Renderer2D::pushImmediateQuad(Texture *texture, u32 features, f32 layer, glm::vec2 pos, glm::vec2 size, glm::vec4 texCoords, glm::vec4 color) {
+    if(immediateQuads == immediateCapacity) {
+        // The old block stays in the arena until the end of the frame
+        u32 capacity = std::max(immediateCapacity * 2, immediateReserve);
+        f32 *vertices = (f32*) frameArena.allocate(capacity * 6 * VERTEX_SIZE_BYTES, alignof(f32));
+
+        if(immediateQuads > 0) {
+            std::memcpy(vertices, immediateVertices, immediateQuads * 6 * VERTEX_SIZE_BYTES);
+        }
+
+        immediateVertices = vertices;
+        immediateCapacity = capacity;
+    }
+
+    if(drawClip) {
+        features |= ShaderVariant::CLIP;
+    }
+
+    writeQuadVertices(&immediateVertices[immediateQuads * 6 * VERTEX_SIZE], pos, pos, size, texCoords, color, drawClip, tick);
+
+    ImmediateRun *last = immediateRuns.empty() ? nullptr : &immediateRuns.back();
+
+    if(last && last->texture == texture && last->features == features && last->layer == layer && last->first + last->count == immediateQuads) {
+        last->count++;
+    } else {
+        immediateRuns.push_back({texture, features, layer, immediateQuads, 1, 0.0f});
+    }
+
+    immediateQuads++;
+}
+
+void photon::Renderer2D::prepareImmediate() {
+    if(immediateRuns.empty()) {
+        return;
+    }
+
+    // Runs are recorded with increasing first quads, so ordering by it keeps the sort stable without
+    // the temporary buffer std::stable_sort allocates
+    std::sort(immediateRuns.begin(), immediateRuns.end(), [](const ImmediateRun &a, const ImmediateRun &b) {
+        return a.layer < b.layer || (a.layer == b.layer && a.first < b.first);
+    });
+
+    // Each run sits between the retained batches of its layer and those of the next one
+    const f32 step = 2.0f / (f32) (drawOrder.size() + 1);
+
+    for(ImmediateRun &run : immediateRuns) {
+        auto after = std::upper_bound(drawOrder.begin(), drawOrder.end(), run.layer, [](f32 layer, const SpriteBatch *batch) {
+            return layer < batch->layer;
+        });
+
+        run.depth = 1.0f - step * ((f32) (after - drawOrder.begin()) + 0.5f);
+    }
+
+    usize size = immediateQuads * 6 * VERTEX_SIZE_BYTES;
+
+    glBindBuffer(GL_ARRAY_BUFFER, immediateVbo);
+
+    // Orphan the previous frame's storage so the upload does not wait on draws still using it
+    if(size > immediateVboSize) {
+        immediateVboSize = std::max(size, immediateVboSize * 2);
+    }
+
+    glBufferData(GL_ARRAY_BUFFER, immediateVboSize, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, immediateVertices);
+}
+
+void photon::Renderer2D::renderImmediate(const ImmediateRun &run) {
+    ShaderProgram *program = getShader(run.features);
+
+    program->bind();
+    program->setMat4("uProj", camera.proj);
+    program->setMat4("uView", camera.view);
+    program->setFloat("uDepth", run.depth);
+    program->setFloat("uTick", tickStamp(tick));
+    program->setFloat("uAlpha", 1.0f);
+    bindClipRects(program, run.features);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(immediateVao);
+
+    if(run.texture) {
+        program->setInt("uTexture", 0);
+        run.texture->bind();
+    }
+
+    glDrawArrays(GL_TRIANGLES, run.first * 6, run.count * 6);
+
+    stats.drawCalls++;
+    stats.sprites += run.count;
+}
+
+void photon::Renderer2D::render() {
+#ifdef PHOTON_PROFILING
+    Profiler::endFrame();
+#endif
+
+    PHOTON_PROFILE_ZONE("Renderer2D::render");
+
+    f64 now = glfwGetTime();
+    stats.frameTime = lastFrameTime > 0.0 ? (f32) ((now - lastFrameTime) * 1000.0) : 0.0f;
+    stats.resolutionScale = 1.0f;
+    stats.drawCalls = 0;
+    stats.sprites = 0;
+    stats.skippedBatches = 0;
+    stats.skippedSprites = 0;
+    stats.spriteRebuilds = 0;
+    stats.ySortMoves = 0;
+    lastFrameTime = now;
+    frameStart = (f32) (now - epoch);
+
+    f32 aspectRatio = window->aspectRatio();
+
+    if(aspectRatio >= 1.0f) {
+        camera.proj = glm::ortho(0.0f, 100.0f * aspectRatio, 0.0f, 100.0f, -1.0f, 1.0f);
+    } else {
+        camera.proj = glm::ortho(0.0f, 100.0f, 0.0f, 100.0f / aspectRatio, -1.0f, 1.0f);
+    }
+
+    camera.view =
+        glm::lookAt(
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 0.0f)
+		    + glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f));
+
+    if(drawOrderDirty) {
+        sortDrawOrder();
+    }
+
+    finishTweens();
+    flushDirtySprites();
+    sortYSortedBatches();
+    cullOccludedBatches();
+    prepareImmediate();
+
+    bool scaled = dynamicResolution.enabled;
+    bool offscreen = scaled || hasActivePostEffects();
+    glm::uvec2 viewport;
+
+    if(offscreen) {
+        viewport = beginOffscreenScene(scaled);
+    }
+
+    // Masks are only written once per frame, so one clear with the depth buffer is enough
+    GLbitfield stencilBit = maskSlots.count() > 1 ? GL_STENCIL_BUFFER_BIT : 0;
+
+    glDepthMask(GL_TRUE);
+    glStencilMask(0xff);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | stencilBit);
+
+    auto uiBegin = drawOrder.end();
+    auto uiRunBegin = immediateRuns.end();
+
+    if(offscreen && dynamicResolution.nativeUi) {
+        uiBegin = std::partition_point(drawOrder.begin(), drawOrder.end(), [this](const SpriteBatch *batch) {
+            return batch->layer < dynamicResolution.uiLayer;
+        });
+
+        uiRunBegin = std::partition_point(immediateRuns.begin(), immediateRuns.end(), [this](const ImmediateRun &run) {
+            return run.layer < dynamicResolution.uiLayer;
+        });
+    }
+
+    renderBatches(drawOrder.begin(), uiBegin, immediateRuns.begin(), uiRunBegin);
+
+    if(offscreen) {
+        endOffscreenScene(scaled, viewport);
+
+        if(uiBegin != drawOrder.end() || uiRunBegin != immediateRuns.end()) {
+            glClear(GL_DEPTH_BUFFER_BIT | stencilBit);
+            renderBatches(uiBegin, drawOrder.end(), uiRunBegin, immediateRuns.end());
+        }
+    }
+
+    immediateRuns.clear();
+    immediateReserve = std::max(immediateQuads, 1024u);
+    immediateVertices = nullptr;
+    immediateQuads = 0;
+    immediateCapacity = 0;
+
+    stats.arenaBytes = frameArena.used();
+    frameArena.reset();
+}
+
+void photon::Renderer2D::sortDrawOrder() {
+    drawOrder = batches;
+
+    // Within a layer translucent batches always draw over opaque ones, and masked batches come last,
+    // grouped by mask with the shapes first so each group sets the stencil state once
+    std::stable_sort(drawOrder.begin(), drawOrder.end(), [](const SpriteBatch *a, const SpriteBatch *b) {
+        if(a->layer != b->layer) {
+            return a->layer < b->layer;
+        }
+
+        if(a->opaque != b->opaque) {
+            return a->opaque;
+        }
+
+        if(a->mask != b->mask) {
+            return a->mask < b->mask;
+        }
+
+        return a->maskShape && !b->maskShape;
+    });
+
+    // Later batches in draw order end up closer to the camera
+    const f32 step = 2.0f / (f32) (drawOrder.size() + 1);
+
+    for(usize i = 0; i < drawOrder.size(); i++) {
+        drawOrder[i]->depth = 1.0f - step * (f32) (i + 1);
+    }
+
+    drawOrderDirty = false;
+}
+
+void photon::Renderer2D::renderBatches(std::pmr::vector<SpriteBatch*>::iterator begin, std::pmr::vector<SpriteBatch*>::iterator end,
+    std::pmr::vector<ImmediateRun>::iterator runBegin, std::pmr::vector<ImmediateRun>::iterator runEnd) {
+    glEnable(GL_DEPTH_TEST);
+
+    // Opaque batches front-to-back so the depth test rejects hidden fragments early
+    glDisable(GL_BLEND);
+
+    for(auto it = std::make_reverse_iterator(end); it != std::make_reverse_iterator(begin); it++) {
+        if((*it)->opaque && (*it)->spriteCount > 0 && !(*it)->occluded) {
+            (*it)->render(camera);
+            stats.drawCalls++;
+            stats.sprites += (*it)->spriteCount;
+        }
+    }
+
+    glEnable(GL_BLEND);
+    glDepthMask(GL_FALSE);
+
+    auto run = runBegin;
+
+    // Masks whose shapes were drawn, and those whose stencil values the shapes of another mask may have replaced since
+    std::bitset<MAX_MASKS> written, overwritten;
+
+    for(auto it = begin; it != end; it++) {
+        // Immediate runs draw after the retained batches of their own layer
+        for(; run != runEnd && run->layer < (*it)->layer; run++) {
+            setStencilState(0, false);
+            renderImmediate(*run);
+        }
+
+        if((*it)->opaque || (*it)->spriteCount == 0 || (*it)->occluded) {
+            continue;
+        }
+
+        u32 mask = (*it)->mask;
+
+        // Content on a later layer than another mask's shapes draws its own shapes again first
+        if(mask != 0 && !(*it)->maskShape && overwritten[mask]) {
+            for(auto shape = begin; shape != it; shape++) {
+                if((*shape)->mask == mask && (*shape)->maskShape && (*shape)->spriteCount > 0 && !(*shape)->occluded) {
+                    setStencilState(mask, true);
+                    (*shape)->render(camera);
+                    stats.drawCalls++;
+                }
+            }
+        }
+
+        if(mask != 0 && ((*it)->maskShape || overwritten[mask])) {
+            written[mask] = true;
+            overwritten |= written;
+            overwritten[mask] = false;
+        }
+
+        setStencilState(mask, (*it)->maskShape);
+        (*it)->render(camera);
+        stats.drawCalls++;
+        stats.sprites += (*it)->spriteCount;
+    }
+
+    setStencilState(0, false);
+
+    for(; run != runEnd; run++) {
+        renderImmediate(*run);
+    }
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
+}
+
+void photon::Renderer2D::flushDirtySprites() {
+    for(SpriteBatch *batch : batches) {
+        stats.spriteRebuilds += batch->flushDirty();
+    }
+}
+
+void photon::Renderer2D::finishTweens() {
+    // Finished sprites may be re-added to new batches, which must not be iterated over here
+    usize count = batches.size();
+
+    for(usize i = 0; i < count; i++) {
+        batches[i]->finishTweens(frameStart);
+    }
+}
+
+void photon::Renderer2D::sortYSortedBatches() {
+    for(SpriteBatch *batch : batches) {
+        if(batch->ySorted) {
+            stats.ySortMoves += batch->sortByY();
+        }
+    }
+}
+
+void photon::Renderer2D::cullOccludedBatches() {
+    glm::mat4 viewProj = camera.proj * camera.view;
+    glm::mat4 inverseViewProj = glm::inverse(viewProj);
+    glm::vec2 windowSize = glm::vec2(window->dimensions);
+
+    glm::vec2 viewMin = glm::vec2(inverseViewProj * glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f));
+    glm::vec2 viewMax = glm::vec2(inverseViewProj * glm::vec4(1.0f, 1.0f, 0.0f, 1.0f));
+
+    // Everything drawn before an opaque sprite covering the whole view is hidden
+    usize firstVisible = 0;
+
+    for(usize i = drawOrder.size(); i > 0; i--) {
+        SpriteBatch *batch = drawOrder[i - 1];
+
+        if(batch->boundsDirty) {
+            batch->recomputeBounds();
+        }
+
+        Sprite *sprite = batch->largestSprite;
+
+        if(batch->opaque && sprite && !sprite->invisible
+            && sprite->pos.x <= viewMin.x && sprite->pos.y <= viewMin.y
+            && sprite->pos.x + sprite->size.x >= viewMax.x && sprite->pos.y + sprite->size.y >= viewMax.y) {
+            firstVisible = i - 1;
+            break;
+        }
+    }
+
+    for(usize i = 0; i < drawOrder.size(); i++) {
+        SpriteBatch *batch = drawOrder[i];
+        batch->occluded = i < firstVisible;
+
+        // Tweened sprites move without updating the bounds
+        if(!batch->occluded && !occluders.empty() && batch->spriteCount > 0 && !batch->tweenData) {
+            if(batch->boundsDirty) {
+                batch->recomputeBounds();
+            }
+
+            glm::vec4 ndcMin = viewProj * glm::vec4(batch->bounds.x, batch->bounds.y, 0.0f, 1.0f);
+            glm::vec4 ndcMax = viewProj * glm::vec4(batch->bounds.z, batch->bounds.w, 0.0f, 1.0f);
+            glm::vec2 screenMin = (glm::vec2(ndcMin) * 0.5f + 0.5f) * windowSize;
+            glm::vec2 screenMax = (glm::vec2(ndcMax) * 0.5f + 0.5f) * windowSize;
+
+            for(const Occluder &occluder : occluders) {
+                if(occluder.layer > batch->layer
+                    && occluder.rect.x <= screenMin.x && occluder.rect.y <= screenMin.y
+                    && occluder.rect.z >= screenMax.x && occluder.rect.w >= screenMax.y) {
+                    batch->occluded = true;
+                    break;
+                }
+            }
+        }
+
+        if(batch->occluded && batch->spriteCount > 0) {
+            stats.skippedBatches++;
+            stats.skippedSprites += batch->spriteCount;
+        }
+    }
+
+    occluders.clear();
+}
+
+glm::uvec2 photon::Renderer2D::beginOffscreenScene(bool scaled) {
+    f32 scale = 1.0f;
+    f32 maxScale = 1.0f;
+
+    if(scaled) {
+        if(!timerQueries[0]) {
+            glGenQueries(TIMER_QUERY_COUNT, timerQueries.data());
+        }
+
+        // Results are read a few frames late so waiting on them never stalls the pipeline
+        if(timerFrame >= TIMER_QUERY_COUNT) {
+            u32 query = timerQueries[timerFrame % TIMER_QUERY_COUNT];
+            i32 available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+            if(available) {
+                u64 elapsed = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                stats.sceneGpuTime = (f32) ((f64) elapsed / 1000000.0);
+                dynamicResolution.update(stats.sceneGpuTime);
+            }
+        }
+
+        scale = glm::clamp(dynamicResolution.scale, dynamicResolution.minScale, dynamicResolution.maxScale);
+        maxScale = dynamicResolution.maxScale;
+    }
+
+    // The target is sized for the largest scale and the scene only uses part of it
+    glm::uvec2 fullSize = glm::max(glm::uvec2(glm::ceil(glm::vec2(window->dimensions) * maxScale)), glm::uvec2(1));
+
+    if(sceneTarget.dimensions != fullSize) {
+        sceneTarget.destroy();
+        sceneTarget = RenderTarget(fullSize.x, fullSize.y);
+    }
+
+    glm::uvec2 viewport = glm::clamp(glm::uvec2(glm::round(glm::vec2(window->dimensions) * scale)), glm::uvec2(1), fullSize);
+    stats.resolutionScale = scale;
+
+    sceneTarget.bind();
+    glViewport(0, 0, viewport.x, viewport.y);
+
+    if(scaled) {
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[timerFrame % TIMER_QUERY_COUNT]);
+    }
+
+    return viewport;
+}
+
+void photon::Renderer2D::endOffscreenScene(bool scaled, glm::uvec2 viewport) {
+    if(scaled) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timerFrame++;
+    }
+
+    u64 signature = computePostSignature();
+
+    if(postPasses.empty() || signature != postSignature) {
+        buildPostPasses();
+        postSignature = signature;
+    }
+
+    glm::uvec2 windowSize = glm::max(window->dimensions, glm::uvec2(1));
+    glm::uvec2 bloomSize = glm::max(windowSize / 2u, glm::uvec2(1));
+
+    const Texture *source = &sceneTarget.texture;
+    glm::vec2 texScale = glm::vec2(viewport) / glm::vec2(sceneTarget.dimensions);
+    glm::vec2 texMax = texScale - 0.5f / glm::vec2(sceneTarget.dimensions);
+    RenderTarget *intermediate = nullptr;
+
+    glDisable(GL_BLEND);
+
+    for(usize i = 0; i < postPasses.size(); i++) {
+        PostPass &pass = postPasses[i];
+
+        if(pass.type == PostPass::BLOOM) {
+            const PostEffect *bloom = pass.effects[0];
+            RenderTarget *bright = targetPool.acquire(bloomSize, RenderTarget::RGBA16F);
+            RenderTarget *blurred = targetPool.acquire(bloomSize, RenderTarget::RGBA16F);
+
+            glViewport(0, 0, bloomSize.x, bloomSize.y);
+
+            bright->bind();
+            bloomExtractShader.bind();
+            bloomExtractShader.setFloat("uThreshold", bloom->params.x);
+            drawFullscreen(&bloomExtractShader, *source, texScale, texMax);
+
+            blurred->bind();
+            blurShader.bind();
+            blurShader.setVec2("uDirection", glm::vec2(bloom->params.z / (f32) bloomSize.x, 0.0f));
+            drawFullscreen(&blurShader, bright->texture, glm::vec2(1.0f), glm::vec2(1.0f));
+
+            bright->bind();
+            blurShader.setVec2("uDirection", glm::vec2(0.0f, bloom->params.z / (f32) bloomSize.y));
+            drawFullscreen(&blurShader, blurred->texture, glm::vec2(1.0f), glm::vec2(1.0f));
+
+            targetPool.release(blurred);
+            bloomTargets[i] = bright;
+            continue;
+        }
+
+        RenderTarget *output = nullptr;
+
+        if(pass.final) {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        } else {
+            output = targetPool.acquire(windowSize, RenderTarget::RGBA8);
+            output->bind();
+        }
+
+        glViewport(0, 0, windowSize.x, windowSize.y);
+        pass.program->bind();
+
+        for(usize j = 0; j < pass.effects.size(); j++) {
+            glUniform4fv(pass.paramLocations[j], 1, &pass.effects[j]->params[0]);
+
+            if(pass.bloomSources[j] >= 0) {
+                Texture::activate(1 + j);
+                bloomTargets[pass.bloomSources[j]]->texture.bind();
+                glUniform1i(pass.bloomLocations[j], 1 + j);
+            }
+        }
+
+        drawFullscreen(pass.program, *source, texScale, texMax);
+
+        for(i32 bloomSource : pass.bloomSources) {
+            if(bloomSource >= 0) {
+                targetPool.release(bloomTargets[bloomSource]);
+                bloomTargets[bloomSource] = nullptr;
+            }
+        }
+
+        if(intermediate) {
+            targetPool.release(intermediate);
+        }
+
+        intermediate = output;
+
+        if(output) {
+            source = &output->texture;
+            texScale = glm::vec2(1.0f);
+            texMax = glm::vec2(1.0f) - 0.5f / glm::vec2(windowSize);
+        }
+    }
+
+    glEnable(GL_BLEND);
+
+    targetPool.collect(120);
+}
+
+bool photon::Renderer2D::hasActivePostEffects() const {
+    for(const PostEffect *effect : postEffects) {
+        if(effect->isActive()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+u64 photon::Renderer2D::computePostSignature() const {
+    u64 hash = 14695981039346656037ull;
+
+    auto mix = [&hash](u64 value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+
+    for(const PostEffect *effect : postEffects) {
+        if(effect->isActive()) {
+            mix((u64) (uintptr_t) effect);
+            mix(effect->type);
+
+            if(effect->type == PostEffect::CUSTOM) {
+                mix(std::hash<std::string>{}(effect->code));
+            }
+        }
+    }
+
+    return hash;
+}
+
+void photon::Renderer2D::buildPostPasses() {
+    postPasses.clear();
+
+    PostPass merged;
+
+    for(PostEffect *effect : postEffects) {
+        if(!effect->isActive()) {
+            continue;
+        }
+
+        if(effect->type == PostEffect::BLOOM) {
+            if(!bloomExtractShader.handle) {
+                bloomExtractShader = ShaderProgram(fullscreenVertexShaderSource, bloomExtractFragmentShaderSource);
+                blurShader = ShaderProgram(fullscreenVertexShaderSource, blurFragmentShaderSource);
+            }
+
+            // Bloom reads the image produced by every effect before it, so those must be resolved first
+            if(!merged.effects.empty()) {
+                postPasses.push_back(merged);
+                merged = PostPass();
+            }
+
+            PostPass bloom;
+            bloom.type = PostPass::BLOOM;
+            bloom.effects.push_back(effect);
+            postPasses.push_back(bloom);
+
+            merged.effects.push_back(effect);
+            merged.bloomSources.push_back((i32) postPasses.size() - 1);
+        } else {
+            merged.effects.push_back(effect);
+            merged.bloomSources.push_back(-1);
+        }
+    }
+
+    merged.final = true;
+    postPasses.push_back(merged);
+
+    for(PostPass &pass : postPasses) {
+        if(pass.type != PostPass::MERGED) {
+            continue;
+        }
+
+        pass.program = getMergedPostProgram(pass);
+
+        for(usize j = 0; j < pass.effects.size(); j++) {
+            std::string index = std::to_string(j);
+            pass.paramLocations.push_back(glGetUniformLocation(pass.program->handle, ("uParams" + index).c_str()));
+            pass.bloomLocations.push_back(glGetUniformLocation(pass.program->handle, ("uBloom" + index).c_str()));
+        }
+    }
+
+    bloomTargets.assign(postPasses.size(), nullptr);
+}
+
+photon::ShaderProgram *photon::Renderer2D::getMergedPostProgram(const PostPass &pass) {
+    std::string source =
+        "#version 330 core\n"
+        "in vec2 vTexCoord;\n"
+        "in vec2 vUv;\n"
+        "out vec4 color;\n"
+        "uniform sampler2D uTexture;\n"
+        "uniform vec2 uTexMax;\n";
+
+    for(usize j = 0; j < pass.effects.size(); j++) {
+        source += "uniform vec4 uParams" + std::to_string(j) + ";\n";
+
+        if(pass.bloomSources[j] >= 0) {
+            source += "uniform sampler2D uBloom" + std::to_string(j) + ";\n";
+        }
+    }
+
+    source +=
+        "void main() {\n"
+        "   vec2 uv = vUv;\n"
+        "   color = texture(uTexture, min(vTexCoord, uTexMax));\n";
+
+    for(usize j = 0; j < pass.effects.size(); j++) {
+        source += "   {\n       vec4 params = uParams" + std::to_string(j) + ";\n";
+        source += postStageCode(pass.effects[j], j);
+        source += "   }\n";
+    }
+
+    source += "}\n";
+
+    auto it = postPrograms.find(source);
+
+    if(it != postPrograms.end()) {
+        return it->second;
+    }
+
+    ShaderProgram *program = new ShaderProgram(fullscreenVertexShaderSource, source);
+    postPrograms[source] = program;
+
+    return program;
+}
+
+void photon::Renderer2D::drawFullscreen(ShaderProgram *program, const Texture &source, glm::vec2 texScale, glm::vec2 texMax) {
+    program->setInt("uTexture", 0);
+    program->setVec2("uTexScale", texScale);
+    program->setVec2("uTexMax", texMax);
+
+    Texture::activate(0);
+    glBindTexture(GL_TEXTURE_2D, source.handle);
+
+    glBindVertexArray(fullscreenVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    stats.drawCalls++;
+}
+
+void photon::Renderer2D::destroy() {
+    spritePool.clear();
+
+    for(SpriteBatch *batch : batches) {
+        batch->destroy();
+        delete batch;
+    }
+
+    for(u32 i = 1; i < ShaderVariant::COUNT; i++) {
+        delete variants[i];
+    }
+
+    sceneTarget.destroy();
+    targetPool.destroy();
+
+    for(auto &entry : postPrograms) {
+        delete entry.second;
+    }
+
+    if(timerQueries[0]) {
+        glDeleteQueries(TIMER_QUERY_COUNT, timerQueries.data());
+    }
+
+    glDeleteVertexArrays(1, &fullscreenVao);
+    glDeleteVertexArrays(1, &immediateVao);
+    glDeleteBuffers(1, &immediateVbo);
+}
+
+photon::WorldStreamer::WorldStreamer(Renderer2D *renderer, f32 cellSize, Loader loader, u32 workerCount)
+    : cellSize(cellSize), renderer(renderer), loader(std::move(loader)) {
+    for(u32 i = 0; i < std::max(workerCount, 1u); i++) {
+        workers.emplace_back(&WorldStreamer::workerLoop, this);
+    }
+}
+
+void photon::WorldStreamer::update(glm::vec2 focus) {
+    glm::ivec2 center = cellAt(focus);
+    std::vector<Cell*> finished;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(loaded);
+
+        // Cells out of range: queued ones are dropped, ones being loaded are dropped by their worker
+        for(auto it = cells.begin(); it != cells.end();) {
+            Cell *cell = it->second;
+            glm::ivec2 distance = glm::abs(cell->coord - center);
+
+            if(std::max(distance.x, distance.y) <= unloadRadius) {
+                it++;
+                continue;
+            }
+
+            if(cell->state == QUEUED) {
+                requests.erase(std::find(requests.begin(), requests.end(), cell));
+                delete cell;
+            } else if(cell->state == LOADING) {
+                cell->discarded = true;
+            } else {
+                committing.erase(std::remove(committing.begin(), committing.end(), cell), committing.end());
+                unload(cell);
+            }
+
+            it = cells.erase(it);
+        }
+
+        bool requested = false;
+
+        for(i32 y = center.y - loadRadius; y <= center.y + loadRadius; y++) {
+            for(i32 x = center.x - loadRadius; x <= center.x + loadRadius; x++) {
+                u64 key = cellKey(glm::ivec2(x, y));
+
+                if(cells.find(key) == cells.end()) {
+                    Cell *cell = new Cell();
+                    cell->coord = glm::ivec2(x, y);
+                    cells[key] = cell;
+                    requests.push_back(cell);
+                    requested = true;
+                }
+            }
+        }
+
+        if(requested || center != focusCell) {
+            std::sort(requests.begin(), requests.end(), [center](const Cell *a, const Cell *b) {
+                glm::ivec2 da = glm::abs(a->coord - center);
+                glm::ivec2 db = glm::abs(b->coord - center);
+                return std::max(da.x, da.y) < std::max(db.x, db.y);
+            });
+        }
+
+        if(requested) {
+            condition.notify_all();
+        }
+    }
+
+    focusCell = center;
+
+    for(Cell *cell : finished) {
+        if(cell->discarded) {
+            unload(cell);
+        } else {
+            cell->state = READY;
+            committing.push_back(cell);
+        }
+    }
+
+    std::sort(committing.begin(), committing.end(), [center](const Cell *a, const Cell *b) {
+        glm::ivec2 da = glm::abs(a->coord - center);
+        glm::ivec2 db = glm::abs(b->coord - center);
+        return std::max(da.x, da.y) < std::max(db.x, db.y);
+    });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((i64) (commitBudget * 1000.0f));
+    usize done = 0;
+    bool progressed = false;
+
+    while(done < committing.size() && commit(committing[done], deadline, progressed)) {
+        done++;
+    }
+
+    committing.erase(committing.begin(), committing.begin() + done);
+}
+
+glm::ivec2 photon::WorldStreamer::cellAt(glm::vec2 pos) const {
+    return glm::ivec2(glm::floor(pos / cellSize));
+}
+
+bool photon::WorldStreamer::isLoaded(glm::ivec2 cell) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cells.find(cellKey(cell));
+    return it != cells.end() && it->second->state == LOADED;
+}
+
+usize photon::WorldStreamer::loadedCells() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    usize count = 0;
+
+    for(const auto &entry : cells) {
+        count += entry.second->state == LOADED;
+    }
+
+    return count;
+}
+
+usize photon::WorldStreamer::pendingCells() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cells.size() - std::count_if(cells.begin(), cells.end(), [](const auto &entry) {
+        return entry.second->state == LOADED;
+    });
+}
+
+photon::WorldStreamer::~WorldStreamer() {
+    stopWorkers();
+}
+
+void photon::WorldStreamer::destroy() {
+    stopWorkers();
+
+    // Finished cells are still in cells unless they were discarded
+    for(Cell *cell : loaded) {
+        if(cell->discarded) {
+            unload(cell);
+        }
+    }
+
+    for(auto &entry : cells) {
+        unload(entry.second);
+    }
+
+    loaded.clear();
+    cells.clear();
+    committing.clear();
+    requests.clear();
+}
+
+u64 photon::WorldStreamer::cellKey(glm::ivec2 cell) {
+    return (u64) (u32) cell.x << 32 | (u32) cell.y;
+}
+
+void photon::WorldStreamer::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+
+    workers.clear();
+}
+
+void photon::WorldStreamer::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true) {
+        condition.wait(lock, [this] {
+            return stopping || !requests.empty();
+        });
+
+        if(stopping) {
+            return;
+        }
+
+        Cell *cell = requests.front();
+        requests.pop_front();
+        cell->state = LOADING;
+
+        lock.unlock();
+
+        loader(cell->coord, cell->content);
+
+        std::vector<CellSprite> &sprites = cell->content.sprites;
+        cell->vertices.resize(sprites.size() * 6 * Renderer2D::VERTEX_SIZE);
+
+        for(usize i = 0; i < sprites.size(); i++) {
+            CellSprite &sprite = sprites[i];
+
+            if(sprite.image != NO_IMAGE && sprite.image >= cell->content.images.size()) {
+                sprite.image = NO_IMAGE;
+            }
+
+            writeQuadVertices(&cell->vertices[i * 6 * Renderer2D::VERTEX_SIZE], sprite.pos, sprite.pos, sprite.size, sprite.texCoords, sprite.color, 0, 0);
+        }
+
+        lock.lock();
+        loaded.push_back(cell);
+    }
+}
+
+bool photon::WorldStreamer::commit(Cell *cell, std::chrono::steady_clock::time_point deadline, bool &progressed) {
+    constexpr usize SPRITES_PER_CHECK = 256;
+
+    std::vector<Image> &images = cell->content.images;
+    const std::vector<CellSprite> &sprites = cell->content.sprites;
+
+    // Sprites point into textures, so it is sized once
+    cell->textures.reserve(images.size());
+
+    // Something is committed every update, however small the budget
+    while(cell->textures.size() < images.size()) {
+        if(progressed && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+
+        Image &image = images[cell->textures.size()];
+        cell->textures.emplace_back(image);
+        image.destroy();
+        progressed = true;
+    }
+
+    cell->handles.reserve(sprites.size());
+
+    while(cell->handles.size() < sprites.size()) {
+        if(progressed && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+
+        progressed = true;
+
+        usize end = std::min(sprites.size(), cell->handles.size() + SPRITES_PER_CHECK);
+
+        for(usize i = cell->handles.size(); i < end; i++) {
+            const CellSprite &source = sprites[i];
+            Texture *texture = source.image != NO_IMAGE ? &cell->textures[source.image] : source.texture;
+
+            Sprite *sprite = renderer->spritePool.create(source.pos, source.size, texture);
+            sprite->color = source.color;
+            sprite->texCoords = source.texCoords;
+            sprite->layer = source.layer;
+            sprite->shaderFeatures = source.shaderFeatures;
+
+            renderer->addSprite(sprite, &cell->vertices[i * 6 * Renderer2D::VERTEX_SIZE]);
+            cell->handles.push_back(sprite->handle);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cell->state = LOADED;
+    cell->content = CellContent();
+    cell->vertices = std::vector<f32>();
+
+    return true;
+}
+
+void photon::WorldStreamer::unload(Cell *cell) {
+    for(SpriteHandle handle : cell->handles) {
+        renderer->spritePool.destroy(handle);
+    }
+
+    for(Texture &texture : cell->textures) {
+        texture.destroy();
+    }
+
+    for(Image &image : cell->content.images) {
+        image.destroy();
+    }
+
+    delete cell;
+}
+
+photon::StartupLoader::StartupLoader(u32 workerCount) : workerCount(workerCount) {
+    if(this->workerCount == 0) {
+        this->workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+}
+
+photon::StartupLoader::Entry &photon::StartupLoader::add(const std::string &name, Kind kind, const std::vector<std::string> &dependencies) {
+    if(started) {
+        std::cerr << "Startup entry " << name << " added after loading started" << std::endl;
+        std::exit(-1);
+    }
+
+    if(names.count(name)) {
+        std::cerr << "Duplicate startup entry " << name << std::endl;
+        std::exit(-1);
+    }
+
+    usize index = entries.size();
+    Entry &entry = entries.emplace_back();
+    entry.name = name;
+    entry.kind = kind;
+
+    for(const std::string &dependency : dependencies) {
+        auto it = names.find(dependency);
+
+        // Requiring dependencies to exist already keeps the manifest order topological
+        if(it == names.end()) {
+            std::cerr << "Startup entry " << name << " depends on " << dependency << ", which was not added before it" << std::endl;
+            std::exit(-1);
+        }
+
+        entry.dependencies.push_back(it->second);
+        entries[it->second].dependents.push_back(index);
+        entry.pendingCpu++;
+    }
+
+    names[name] = index;
+    return entry;
+}
+
+void photon::StartupLoader::addTexture(const std::string &name, Texture *texture, const std::string &path, Texture::TextureType type,
+    const std::vector<std::string> &dependencies) {
+    Entry *entry = &add(name, TEXTURE, dependencies);
+
+    entry->cpu = [entry, path, type] {
+        entry->image = Image(path, type);
+    };
+
+    entry->gl = [entry, texture] {
+        *texture = Texture(entry->image);
+        entry->image.destroy();
+    };
+}
+
+void photon::StartupLoader::addFont(const std::string &name, Font *font, const std::string &path, const std::vector<std::string> &dependencies) {
+    Entry *entry = &add(name, FONT, dependencies);
+    entry->font = font;
+
+    entry->cpu = [font, path] {
+        font->file = MappedFile::acquire(path);
+
+        if(!font->file) {
+            std::cerr << "Failed to open TTF file " << path << std::endl;
+            std::exit(-1);
+        }
+
+        font->bake(font->file->data, font->file->size);
+    };
+
+    entry->gl = [font] {
+        font->upload();
+    };
+}
+
+void photon::StartupLoader::addShader(const std::string &name, ShaderProgram *program, std::string vertexSource, std::string fragmentSource,
+    const std::vector<std::string> &dependencies) {
+    Entry &entry = add(name, SHADER, dependencies);
+
+    entry.gl = [program, vertexSource = std::move(vertexSource), fragmentSource = std::move(fragmentSource)] {
+        *program = ShaderProgram(vertexSource, fragmentSource);
+    };
+}
+
+void photon::StartupLoader::addShaderVariant(const std::string &name, Renderer2D *renderer, u32 features, const std::vector<std::string> &dependencies) {
+    Entry &entry = add(name, SHADER, dependencies);
+
+    entry.gl = [renderer, features] {
+        renderer->getShader(features);
+    };
+}
+
+void photon::StartupLoader::addTask(const std::string &name, Step cpu, Step gl, const std::vector<std::string> &dependencies) {
+    Entry &entry = add(name, TASK, dependencies);
+    entry.cpu = std::move(cpu);
+    entry.gl = std::move(gl);
+}
+
+bool photon::StartupLoader::update(f32 budget) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<f32, std::milli>(budget));
+
+    return run(deadline, false);
+}
+
+void photon::StartupLoader::finish() {
+    run(std::chrono::steady_clock::time_point::max(), true);
+}
+
+bool photon::StartupLoader::isDone() const {
+    return loaded == entries.size();
+}
+
+usize photon::StartupLoader::loadedCount() const {
+    return loaded;
+}
+
+usize photon::StartupLoader::count() const {
+    return entries.size();
+}
+
+std::vector<photon::StartupLoader::Timing> photon::StartupLoader::timeline() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Timing> timings;
+
+    for(const Entry &entry : entries) {
+        if(entry.glDone) {
+            timings.push_back({entry.name, entry.kind, entry.worker, entry.cpuStart, entry.cpuEnd, entry.glStart, entry.glEnd});
+        }
+    }
+
+    return timings;
+}
+
+void photon::StartupLoader::printTimeline(std::ostream &out) const {
+    static const char *kindNames[] = {"texture", "font", "shader", "task"};
+
+    std::vector<Timing> timings = timeline();
+    f64 total = 0.0;
+    f64 sequential = 0.0;
+    usize nameWidth = 4;
+
+    for(const Timing &timing : timings) {
+        total = std::max(total, timing.glEnd);
+        sequential += timing.cpuEnd - timing.cpuStart + timing.glEnd - timing.glStart;
+        nameWidth = std::max(nameWidth, timing.name.size());
+    }
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "Startup: %zu of %zu loaded in %.1f ms on %u workers, %.1f ms in sequence\n",
+        timings.size(), entries.size(), total, workerCount, sequential);
+    out << line;
+
+    std::snprintf(line, sizeof(line), "  %-*s %-7s %6s %17s %17s\n", (i32) nameWidth, "name", "kind", "worker", "cpu ms", "gl ms");
+    out << line;
+
+    for(const Timing &timing : timings) {
+        std::snprintf(line, sizeof(line), "  %-*s %-7s %6u %8.1f-%8.1f %8.1f-%8.1f\n", (i32) nameWidth, timing.name.c_str(), kindNames[timing.kind],
+            timing.worker, timing.cpuStart, timing.cpuEnd, timing.glStart, timing.glEnd);
+        out << line;
+    }
+}
+
+photon::StartupLoader::~StartupLoader() {
+    stopWorkers();
+}
+
+void photon::StartupLoader::destroy() {
+    stopWorkers();
+
+    for(Entry &entry : entries) {
+        if(entry.glDone) {
+            continue;
+        }
+
+        entry.image.destroy();
+
+        // Only the CPU half exists, the font's texture was never created
+        if(entry.font && entry.cpuDone) {
+            delete[] entry.font->packedCharsBuffer;
+            entry.font->packedCharsBuffer = nullptr;
+
+            delete[] entry.font->bitmap;
+            entry.font->bitmap = nullptr;
+
+            MappedFile::release(entry.font->file);
+            entry.font->file = nullptr;
+        }
+    }
+}
+
+f64 photon::StartupLoader::elapsed() const {
+    return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void photon::StartupLoader::start() {
+    if(started) {
+        return;
+    }
+
+    started = true;
+    startTime = std::chrono::steady_clock::now();
+
+    for(usize i = 0; i < entries.size(); i++) {
+        if(entries[i].pendingCpu == 0) {
+            ready.push_back(i);
+        }
+    }
+
+    for(u32 i = 0; i < workerCount; i++) {
+        workers.emplace_back(&StartupLoader::workerLoop, this, i + 1);
+    }
+}
+
+void photon::StartupLoader::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+
+    workers.clear();
+}
+
+bool photon::StartupLoader::run(std::chrono::steady_clock::time_point deadline, bool wait) {
+    start();
+
+    while(loaded < entries.size()) {
+        Entry *entry;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            entry = nextUpload();
+
+            while(!entry && wait) {
+                condition.wait(lock);
+                entry = nextUpload();
+            }
+        }
+
+        if(!entry) {
+            break;
+        }
+
+        entry->glStart = elapsed();
+
+        if(entry->gl) {
+            entry->gl();
+        }
+
+        entry->glEnd = elapsed();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entry->glDone = true;
+        }
+
+        loaded++;
+
+        if(std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+
+    return isDone();
+}
+
+photon::StartupLoader::Entry *photon::StartupLoader::nextUpload() {
+    while(firstPending < entries.size() && entries[firstPending].glDone) {
+        firstPending++;
+    }
+
+    // Dependencies come earlier in the manifest, so this picks entries in dependency order
+    for(usize i = firstPending; i < entries.size(); i++) {
+        Entry &entry = entries[i];
+
+        if(entry.glDone || !entry.cpuDone) {
+            continue;
+        }
+
+        bool dependenciesDone = true;
+
+        for(usize dependency : entry.dependencies) {
+            dependenciesDone = dependenciesDone && entries[dependency].glDone;
+        }
+
+        if(dependenciesDone) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+void photon::StartupLoader::workerLoop(u32 worker) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true) {
+        condition.wait(lock, [this] {
+            return stopping || !ready.empty();
+        });
+
+        if(stopping) {
+            return;
+        }
+
+        Entry &entry = entries[ready.front()];
+        ready.pop_front();
+
+        lock.unlock();
+
+        entry.worker = worker;
+        entry.cpuStart = elapsed();
+
+        if(entry.cpu) {
+            entry.cpu();
+        }
+
+        entry.cpuEnd = elapsed();
+
+        lock.lock();
+        entry.cpuDone = true;
+
+        for(usize dependent : entry.dependents) {
+            if(--entries[dependent].pendingCpu == 0) {
+                ready.push_back(dependent);
+            }
+        }
+
+        // Wakes other workers for the dependents and the GL thread for the upload
+        condition.notify_all();
+    }
+}
+
+static std::mutex profilerMutex;
+static std::vector<photon::Profiler::Zone*> profilerZones;
+static std::atomic<bool> profilerCounting {false};
+
+#ifdef __linux__
+// One counter group per thread, so a single read() returns every counter
+struct PerfCounters {
+    i32 fds[photon::Profiler::COUNTER_COUNT] = {-1, -1, -1, -1};
+    bool opened = false;
+    bool valid = false;
+
+    ~PerfCounters() {
+        close();
+    }
+
+    bool open() {
+        static const u64 configs[photon::Profiler::COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for(u32 i = 0; i < photon::Profiler::COUNTER_COUNT; i++) {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            fds[i] = (i32) syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+
+            if(fds[i] < 0) {
+                close();
+                return false;
+            }
+        }
+
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    void close() {
+        for(i32 &fd : fds) {
+            if(fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    bool sample(std::array<u64, photon::Profiler::COUNTER_COUNT> &values) {
+        if(!opened) {
+            opened = true;
+            valid = open();
+        }
+
+        // Counter count followed by the values in the order the group was opened
+        u64 buffer[1 + photon::Profiler::COUNTER_COUNT];
+
+        if(!valid || ::read(fds[0], buffer, sizeof(buffer)) != (ssize_t) sizeof(buffer)) {
+            return false;
+        }
+
+        std::memcpy(values.data(), buffer + 1, sizeof(u64) * photon::Profiler::COUNTER_COUNT);
+        return true;
+    }
+};
+
+static thread_local PerfCounters perfCounters;
+#endif
+
+static bool sampleCounters(std::array<u64, photon::Profiler::COUNTER_COUNT> &values) {
+#ifdef __linux__
+    return perfCounters.sample(values);
+#else
+    return false;
+#endif
+}
+
+static photon::Profiler::Sample loadSample(const photon::Profiler::Zone *zone) {
+    photon::Profiler::Sample sample;
+    sample.calls = zone->calls.load(std::memory_order_relaxed);
+    sample.nanoseconds = zone->nanoseconds.load(std::memory_order_relaxed);
+
+    for(u32 i = 0; i < photon::Profiler::COUNTER_COUNT; i++) {
+        sample.counters[i] = zone->counters[i].load(std::memory_order_relaxed);
+    }
+
+    return sample;
+}
+
+photon::Profiler::Zone::Zone(const char *name) : name(name), calls(0), nanoseconds(0) {
+    for(std::atomic<u64> &counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+}
+
+photon::Profiler::Zone *photon::Profiler::zone(const char *name) {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+
+    for(Zone *zone : profilerZones) {
+        if(std::strcmp(zone->name, name) == 0) {
+            return zone;
+        }
+    }
+
+    profilerZones.push_back(new Zone(name));
+    return profilerZones.back();
+}
+
+bool photon::Profiler::enableCounters() {
+    std::array<u64, COUNTER_COUNT> values;
+
+    // Other threads open theirs on their first zone
+    if(!sampleCounters(values)) {
+        return false;
+    }
+
+    profilerCounting.store(true);
+    return true;
+}
+
+void photon::Profiler::disableCounters() {
+    profilerCounting.store(false);
+}
+
+bool photon::Profiler::countersEnabled() {
+    return profilerCounting.load();
+}
+
+void photon::Profiler::endFrame() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+
+    for(Zone *zone : profilerZones) {
+        Sample now = loadSample(zone);
+
+        zone->lastFrame.calls = now.calls - zone->frameStart.calls;
+        zone->lastFrame.nanoseconds = now.nanoseconds - zone->frameStart.nanoseconds;
+
+        for(u32 i = 0; i < COUNTER_COUNT; i++) {
+            zone->lastFrame.counters[i] = now.counters[i] - zone->frameStart.counters[i];
+        }
+
+        zone->frameStart = now;
+    }
+}
+
+std::vector<photon::Profiler::Report> photon::Profiler::report() {
+    std::vector<Report> reports;
+
+    {
+        std::lock_guard<std::mutex> lock(profilerMutex);
+
+        for(Zone *zone : profilerZones) {
+            reports.push_back({zone->name, zone->lastFrame, loadSample(zone)});
+        }
+    }
+
+    std::sort(reports.begin(), reports.end(), [](const Report &a, const Report &b) {
+        return a.total.nanoseconds > b.total.nanoseconds;
+    });
+
+    return reports;
+}
+
+void photon::Profiler::printReport(std::ostream &out, bool totals) {
+    std::vector<Report> reports = report();
+    bool counting = countersEnabled();
+    char line[256];
+
+    out << (totals ? "Profile totals" : "Profile last frame") << (counting ? "" : ", counters disabled") << "\n";
+
+    std::snprintf(line, sizeof(line), "  %-28s %10s %10s", "zone", "calls", "ms");
+    out << line;
+
+    if(counting) {
+        std::snprintf(line, sizeof(line), " %14s %6s %12s %12s %10s", "cycles", "IPC", "cache miss", "branch miss", "miss/call");
+        out << line;
+    }
+
+    out << "\n";
+
+    for(const Report &report : reports) {
+        const Sample &sample = totals ? report.total : report.frame;
+
+        std::snprintf(line, sizeof(line), "  %-28s %10llu %10.3f", report.name, (unsigned long long) sample.calls, (f64) sample.nanoseconds / 1000000.0);
+        out << line;
+
+        if(counting) {
+            f64 cycles = (f64) sample.counters[CYCLES];
+            std::snprintf(line, sizeof(line), " %14llu %6.2f %12llu %12llu %10.2f", (unsigned long long) sample.counters[CYCLES],
+                cycles > 0.0 ? (f64) sample.counters[INSTRUCTIONS] / cycles : 0.0, (unsigned long long) sample.counters[CACHE_MISSES],
+                (unsigned long long) sample.counters[BRANCH_MISSES], sample.calls > 0 ? (f64) sample.counters[CACHE_MISSES] / (f64) sample.calls : 0.0);
+            out << line;
+        }
+
+        out << "\n";
+    }
+}
+
+void photon::Profiler::reset() {
+    std::lock_guard<std::mutex> lock(profilerMutex);
+
+    for(Zone *zone : profilerZones) {
+        zone->calls.store(0, std::memory_order_relaxed);
+        zone->nanoseconds.store(0, std::memory_order_relaxed);
+
+        for(std::atomic<u64> &counter : zone->counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+
+        zone->frameStart = Sample();
+        zone->lastFrame = Sample();
+    }
+}
+
+photon::ProfileScope::ProfileScope(Profiler::Zone *zone) : zone(zone) {
+    if(profilerCounting.load(std::memory_order_relaxed)) {
+        counting = sampleCounters(counters);
+    }
+
+    start = std::chrono::steady_clock::now();
+}
+
+photon::ProfileScope::~ProfileScope() {
+    u64 elapsed = (u64) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    zone->calls.fetch_add(1, std::memory_order_relaxed);
+    zone->nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+
+    std::array<u64, Profiler::COUNTER_COUNT> end;
+
+    if(counting && sampleCounters(end)) {
+        for(u32 i = 0; i < Profiler::COUNTER_COUNT; i++) {
+            zone->counters[i].fetch_add(end[i] - counters[i], std::memory_order_relaxed);
+        }
+    }
+}
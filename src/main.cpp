@@ -12,8 +12,31 @@ int main() {
 
     photon::Renderer2D renderer(&window);
     renderer.setClearColor(0.0f, 0.0f, 1.0f, 1.0f);
-    photon::Texture nullTexture("../resources/null.png", photon::Texture::RGBA);
-    photon::Texture cowTexture("../resources/cow.png", photon::Texture::RGBA);
+
+    photon::Texture nullTexture;
+    photon::Texture cowTexture;
+    photon::Font font;
+
+    photon::StartupLoader loader;
+    loader.addTexture("null", &nullTexture, "../resources/null.png", photon::Texture::RGBA);
+    loader.addTexture("cow", &cowTexture, "../resources/cow.png", photon::Texture::RGBA);
+    loader.addFont("arial", &font, "../resources/arial.ttf");
+
+    // Keep the window responsive while the workers load
+    while(!loader.update(4.0f) && !window.shouldClose()) {
+        renderer.render();
+        window.endFrame();
+    }
+
+    loader.printTimeline(std::cout);
+    loader.destroy();
+
+    if(!loader.isDone()) {
+        renderer.destroy();
+        window.destroy();
+
+        return 0;
+    }
 
     photon::Sprite sprite(glm::vec2(0.0f), glm::vec2(25.0f), &nullTexture);
     photon::Sprite sprite2(glm::vec2(25.0f, 0.0f), glm::vec2(25.0f), &cowTexture);
@@ -21,7 +44,6 @@ int main() {
     renderer.addSprite(&sprite);
     renderer.addSprite(&sprite2);
 
-    photon::Font font("../resources/arial.ttf");
     photon::Text text(&font, "Hello, Photon!", glm::vec2(0.0f, 50.0f), 0.15f, glm::vec4(1.0f), 0.5f, false);
     renderer.addText(&text);
 
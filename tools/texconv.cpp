@@ -0,0 +1,148 @@
+#include <photon2d.hpp>
+#include <stb_image/stb_image.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+static std::vector<u8> readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool endsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Milliseconds per call, best of the given number of runs
+template<typename Function>
+static f64 timeBest(u32 runs, Function function) {
+    f64 best = 1e30;
+
+    for(u32 i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    return best;
+}
+
+static i32 convert(const std::string &input, const std::string &output) {
+    bool qoi = endsWith(output, ".qoi");
+
+    if(!qoi && !endsWith(output, ".lz4")) {
+        std::cerr << "Output must end in .qoi or .lz4" << std::endl;
+        return 1;
+    }
+
+    i32 width, height, channels;
+
+    if(!stbi_info(input.c_str(), &width, &height, &channels)) {
+        std::cerr << "Failed to load image " << input << std::endl;
+        return 1;
+    }
+
+    // QOI has no single channel mode, and neither format keeps gray and alpha pairs
+    u32 stored = channels == 3 ? 3 : channels == 1 && !qoi ? 1 : 4;
+    u8 *pixels = stbi_load(input.c_str(), &width, &height, &channels, (i32) stored);
+
+    // stbi_info only reads the header, the pixel data can still be truncated or corrupt
+    if(!pixels) {
+        std::cerr << "Failed to decode image " << input << ": " << stbi_failure_reason() << std::endl;
+        return 1;
+    }
+
+    std::vector<u8> encoded = qoi ? photon::Image::encodeQoi(pixels, width, height, stored) : photon::Image::encodeLz4(pixels, width, height, stored);
+    stbi_image_free(pixels);
+
+    std::ofstream file(output, std::ios::binary);
+    file.write((const char*) encoded.data(), encoded.size());
+
+    if(!file) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+
+    std::cout << input << " -> " << output << ": " << width << "x" << height << "x" << stored << ", " << encoded.size() << " bytes" << std::endl;
+
+    return 0;
+}
+
+// Decodes one image from memory with stb_image and from both fast formats, so disk speed is not measured
+static i32 bench(const std::string &input, u32 runs) {
+    std::vector<u8> bytes = readFile(input);
+    photon::Image reference = photon::Image::decode(bytes.data(), bytes.size(), photon::Texture::RGBA);
+
+    if(!reference.data) {
+        std::cerr << "Failed to load image " << input << std::endl;
+        return 1;
+    }
+
+    const f64 megabytes = (f64) reference.width * reference.height * 4 / (1024.0 * 1024.0);
+
+    std::vector<u8> qoi = photon::Image::encodeQoi(reference.data, reference.width, reference.height, 4);
+    std::vector<u8> lz4 = photon::Image::encodeLz4(reference.data, reference.width, reference.height, 4);
+
+    struct Format {
+        const char *name;
+        const std::vector<u8> *encoded;
+    };
+
+    std::cout << input << ": " << reference.width << "x" << reference.height << ", best of " << runs << std::endl;
+
+    for(const Format &format : {Format{"stbi_load", &bytes}, Format{"QOI", &qoi}, Format{"LZ4", &lz4}}) {
+        bool matches = true;
+        bool decoded = true;
+
+        f64 ms = timeBest(runs, [&]() {
+            i32 width, height, channels;
+            u8 *data = format.encoded == &bytes
+                ? stbi_load_from_memory(bytes.data(), (i32) bytes.size(), &width, &height, &channels, 4)
+                : photon::Image::decode(format.encoded->data(), format.encoded->size(), photon::Texture::RGBA).data;
+
+            decoded = decoded && data;
+            matches = matches && data && std::memcmp(data, reference.data, (usize) reference.width * reference.height * 4) == 0;
+            std::free(data);
+        });
+
+        // The input itself may already be in one of the fast formats
+        if(!decoded) {
+            printf("  %-10s %10zu bytes  not supported\n", format.name, format.encoded->size());
+            continue;
+        }
+
+        printf("  %-10s %10zu bytes %9.2f ms %9.1f MB/s%s\n", format.name, format.encoded->size(), ms, megabytes / (ms / 1000.0),
+            matches ? "" : "  MISMATCH");
+    }
+
+    reference.destroy();
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if(argc >= 3 && std::string(argv[1]) == "--bench") {
+        u32 runs = 5;
+        i32 result = 0;
+
+        for(i32 i = 2; i < argc; i++) {
+            if(std::string(argv[i]) == "--runs" && i + 1 < argc) {
+                runs = (u32) std::max(std::atoi(argv[++i]), 1);
+            } else {
+                result |= bench(argv[i], runs);
+            }
+        }
+
+        return result;
+    }
+
+    if(argc == 3) {
+        return convert(argv[1], argv[2]);
+    }
+
+    std::cerr << "Usage: photon2d-texconv <input> <output.qoi|output.lz4>" << std::endl;
+    std::cerr << "       photon2d-texconv --bench [--runs n] <input>..." << std::endl;
+
+    return 1;
+}